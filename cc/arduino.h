@@ -17,6 +17,9 @@ class ArduinoInterface : public SerialInterface, public Clock {
   virtual void setPinModeInput(unsigned int pin) = 0;
   virtual void setPinModePullup(unsigned int pin) = 0;
 
+  // Keeps the bulk overloads visible alongside the byte calls below.
+  using SerialInterface::write;
+  using SerialInterface::read;
   virtual void write(const unsigned char c) override = 0;
   virtual unsigned char read() override = 0;
   virtual bool available() override = 0;
@@ -0,0 +1,95 @@
+#include "channel_mux.h"
+#include "sync_scanner.h"
+#include <string.h>
+
+namespace tensixty {
+
+ChannelMux::ChannelMux(SerialInterface *serial)
+  : serial_(serial), channel_count_(0), rx_start_(0), rx_end_(0),
+    frame_remaining_(0), frame_channel_(0) {}
+
+bool ChannelMux::AddChannel(RxTxPair *pair, const unsigned int priority,
+    const unsigned int weight) {
+  if (channel_count_ >= MAX_CHANNELS || weight == 0) return false;
+  if (Find(pair->channel()) != nullptr) return false;
+  Channel &c = channels_[channel_count_++];
+  c.pair = pair;
+  c.priority = priority;
+  c.weight = weight;
+  c.current = 0;
+  return true;
+}
+
+RxTxPair* ChannelMux::Find(const unsigned int channel) const {
+  for (unsigned int i = 0; i < channel_count_; ++i) {
+    if (channels_[i].pair->channel() == channel) return channels_[i].pair;
+  }
+  return nullptr;
+}
+
+void ChannelMux::Tick() {
+  while (Read());
+  for (unsigned int i = 0; i < channel_count_; ++i) {
+    channels_[i].pair->writer_.HandleAcks();
+  }
+  const int data_channel = PickDataChannel();
+  for (unsigned int i = 0; i < channel_count_; ++i) {
+    channels_[i].pair->writer_.WriteFrame(static_cast<int>(i) == data_channel);
+  }
+}
+
+bool ChannelMux::Read() {
+  if (rx_start_ > 0) {
+    memmove(rx_, rx_ + rx_start_, rx_end_ - rx_start_);
+    rx_end_ -= rx_start_;
+    rx_start_ = 0;
+  }
+  rx_end_ += serial_->read(rx_ + rx_end_, sizeof(rx_) - rx_end_);
+  if (frame_remaining_ == 0) {
+    // Route by the header, once it is all here.
+    const unsigned char *start = FindFrameStart(rx_, rx_end_);
+    rx_start_ = start - rx_;
+    const size_t available = rx_end_ - rx_start_;
+    if (available < 3) return false;
+    const unsigned int header_size = FrameHeaderSize(start);
+    if (available < header_size) return false;
+    frame_remaining_ = FrameSize(start);
+    frame_channel_ = FrameChannel(start);
+  }
+  const size_t available = rx_end_ - rx_start_;
+  const size_t length = available < frame_remaining_ ? available : frame_remaining_;
+  if (length == 0) return false;
+  RxTxPair *pair = Find(frame_channel_);
+  // Frames for channels we don't serve are dropped.
+  size_t consumed = length;
+  if (pair != nullptr) pair->reader_.Read(rx_ + rx_start_, length, &consumed);
+  // The reader is waiting on its acks; try again next tick.
+  if (consumed == 0) return false;
+  rx_start_ += consumed;
+  frame_remaining_ -= consumed;
+  return true;
+}
+
+int ChannelMux::PickDataChannel() {
+  int best = -1;
+  for (unsigned int i = 0; i < channel_count_; ++i) {
+    if (!channels_[i].pair->writer_.HasDataToSend()) continue;
+    if (best < 0 || channels_[i].priority < channels_[best].priority) best = i;
+  }
+  if (best < 0) return -1;
+  // Smooth weighted round robin among the ready channels of that priority.
+  const unsigned int priority = channels_[best].priority;
+  int total = 0;
+  best = -1;
+  for (unsigned int i = 0; i < channel_count_; ++i) {
+    Channel &c = channels_[i];
+    if (c.priority != priority || !c.pair->writer_.HasDataToSend()) continue;
+    c.current += c.weight;
+    total += c.weight;
+    if (best < 0 || c.current > channels_[best].current) best = i;
+  }
+  channels_[best].current -= total;
+  return best;
+}
+
+}  // namespace tensixty
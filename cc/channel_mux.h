@@ -0,0 +1,64 @@
+#ifndef TENSIXTY_CHANNEL_MUX_H_
+#define TENSIXTY_CHANNEL_MUX_H_
+
+#include "commlink.h"
+#include "packet.h"
+#include "serial_interface.h"
+
+namespace tensixty {
+
+// Most logical channels sharing one serial link.
+#ifndef TENSIXTY_MAX_CHANNELS
+#define TENSIXTY_MAX_CHANNELS 4
+#endif
+const unsigned int MAX_CHANNELS = TENSIXTY_MAX_CHANNELS;
+
+// Shares one serial link between RxTxPairs, each set up with its own
+// LinkConfig::channel on the same serial interface. Every channel has its own
+// sequence space, window and retransmits, so a lost bulk packet never holds up
+// control traffic.
+//
+// Call Transmit() and Receive() on each pair as usual, but Tick() the mux
+// instead of the pairs. Each tick sends one data packet, from the channel
+// with the lowest priority number that has one; channels of equal priority
+// share the link in proportion to their weights. Acks go out on every
+// channel each tick, whichever sends data.
+class ChannelMux {
+ public:
+  ChannelMux(SerialInterface *serial);
+  // Returns false if the channel number is taken or there is no room left.
+  bool AddChannel(RxTxPair *pair, unsigned int priority = 0, unsigned int weight = 1);
+  void Tick();
+
+ private:
+  struct Channel {
+    RxTxPair *pair;
+    unsigned int priority;
+    int weight;
+    // Smooth weighted round robin credit.
+    int current;
+  };
+
+  // Routes incoming bytes to the reader of their frame's channel. Returns
+  // false once nothing more can be routed this tick.
+  bool Read();
+  RxTxPair* Find(unsigned int channel) const;
+  // Index of the channel that sends data this tick, or -1 if none has any.
+  int PickDataChannel();
+
+  SerialInterface *serial_;
+  Channel channels_[MAX_CHANNELS];
+  unsigned int channel_count_;
+
+  // Enough for a read chunk behind a partial header.
+  unsigned char rx_[READ_CHUNK_SIZE + MAX_HEADER_SIZE];
+  size_t rx_start_;
+  size_t rx_end_;
+  // Bytes of the current frame still to route, and where they go.
+  size_t frame_remaining_;
+  unsigned int frame_channel_;
+};
+
+}  // namespace tensixty
+
+#endif  // TENSIXTY_CHANNEL_MUX_H_
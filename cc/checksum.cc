@@ -0,0 +1,79 @@
+#include "checksum.h"
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define TENSIXTY_CHECKSUM_SSE2
+#endif
+
+namespace tensixty {
+
+// Both sums are only kept modulo 256, so any wider accumulator can be used and
+// truncated at the end. Over a block of n bytes b_0..b_(n-1):
+//   first += sum(b_k)
+//   second += n * first + sum((n - k) * b_k)
+#if defined(__AVR__)
+
+// 8-bit adds are cheapest on the AVR, so stay byte-wise.
+void Fletcher::Update(const unsigned char *buf, size_t length) {
+  unsigned char first = first_;
+  unsigned char second = second_;
+  while (length-- > 0) {
+    first += *buf++;
+    second += first;
+  }
+  first_ = first;
+  second_ = second;
+}
+
+#else
+
+void Fletcher::Update(const unsigned char *buf, size_t length) {
+  unsigned int first = first_;
+  unsigned int second = second_;
+#ifdef TENSIXTY_CHECKSUM_SSE2
+  const size_t num_blocks = length / 16;
+  if (num_blocks > 0) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low_weights = _mm_set_epi16(9, 10, 11, 12, 13, 14, 15, 16);
+    const __m128i high_weights = _mm_set_epi16(1, 2, 3, 4, 5, 6, 7, 8);
+    // Per-lane sums of the bytes, of the weighted bytes, and of the byte sum
+    // as it stood before each block.
+    __m128i block_sums = zero;
+    __m128i weighted_sums = zero;
+    __m128i prior_sums = zero;
+    for (size_t block = 0; block < num_blocks; ++block) {
+      const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+      prior_sums = _mm_add_epi32(prior_sums, block_sums);
+      block_sums = _mm_add_epi32(block_sums, _mm_sad_epu8(bytes, zero));
+      weighted_sums = _mm_add_epi32(weighted_sums,
+          _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), low_weights),
+                        _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), high_weights)));
+      buf += 16;
+    }
+    unsigned int lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), prior_sums);
+    const unsigned int prior = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), weighted_sums);
+    const unsigned int weighted = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), block_sums);
+    const unsigned int sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    second += 16 * num_blocks * first + 16 * prior + weighted;
+    first += sum;
+    length -= 16 * num_blocks;
+  }
+#endif  // TENSIXTY_CHECKSUM_SSE2
+  for (; length >= 4; length -= 4) {
+    second += 4 * first + 4 * buf[0] + 3 * buf[1] + 2 * buf[2] + buf[3];
+    first += buf[0] + buf[1] + buf[2] + buf[3];
+    buf += 4;
+  }
+  for (; length > 0; --length) {
+    first += *buf++;
+    second += first;
+  }
+  first_ = first;
+  second_ = second;
+}
+
+#endif  // __AVR__
+
+}  // namespace tensixty
@@ -0,0 +1,35 @@
+#ifndef TENSIXTY_CHECKSUM_H_
+#define TENSIXTY_CHECKSUM_H_
+
+#include <stddef.h>
+
+namespace tensixty {
+
+// Fletcher checksum used for both frame headers and payloads: a running sum
+// of the bytes, and a running sum of that sum, both modulo 256.
+class Fletcher {
+ public:
+  Fletcher() : first_(0), second_(0) {}
+  void Reset() {
+    first_ = 0;
+    second_ = 0;
+  }
+
+  void Update(const unsigned char c) {
+    first_ += c;
+    second_ += first_;
+  }
+  // Same result as calling Update() on each byte in order.
+  void Update(const unsigned char *buf, size_t length);
+
+  unsigned char first() const { return first_; }
+  unsigned char second() const { return second_; }
+
+ private:
+  unsigned char first_;
+  unsigned char second_;
+};
+
+}  // namespace tensixty
+
+#endif  // TENSIXTY_CHECKSUM_H_
@@ -1,181 +1,373 @@
 #include "commlink.h"
+#include "trace.h"
 #include <string.h>
-#include <stdio.h>
 
 namespace tensixty {
 namespace {
 
-const long long kResendPeriod = 100000LL;
-unsigned char NextIndex(unsigned char index) {
+unsigned int NextIndex(unsigned int index, const unsigned int max_index) {
   index += 1;
-  return index == 128 ? 1 : index;
+  return index > max_index ? 1 : index;
 }
 
-Packet* AllocatePacketFromArray(const int array_size, bool* live_indices, Packet* packet_array, int* index) {
-  for (int i = 0; i < array_size ; ++i) {
-    if (!live_indices[i]) {
-      live_indices[i] = true;
-      packet_array[i].Reset();
-      *index = i;
-      return &packet_array[i];
-    }
-  }
-  return nullptr;
+// Steps forward from index from to index to, where indices run from 1 to
+// max_index and then wrap. From may also be 0, before the first index.
+unsigned int IndexDistance(const unsigned int from, const unsigned int to,
+    const unsigned int max_index) {
+  return (to + max_index - from) % max_index;
 }
 
-void IncrementIndex(unsigned char *index) {
-  *index += 1;
-  if (*index >= 128) {
-    *index = 1;
-  }
+// Steps count indices forward from index.
+unsigned int AdvanceIndex(const unsigned int index, const unsigned int count,
+    const unsigned int max_index) {
+  return count == 0 ? index : (index + count - 1) % max_index + 1;
+}
+
+// True if index comes after limit, allowing for wrap around.
+bool IndexAfter(const unsigned int index, const unsigned int limit, const unsigned int max_index) {
+  const unsigned int distance = IndexDistance(limit, index, max_index);
+  return distance != 0 && distance < max_index / 2;
+}
+
+// The window actually used for a requested size and index space.
+unsigned int ClampWindowSize(unsigned int window_size, const unsigned int max_index) {
+  if (window_size > BUFFER_SIZE) window_size = BUFFER_SIZE;
+  if (window_size > max_index / 4) window_size = max_index / 4;
+  return window_size < 1 ? 1 : window_size;
+}
+
+SlotMask SlotBit(const unsigned int slot) {
+  return static_cast<SlotMask>(1) << slot;
+}
+
+// Bits 0 to count - 1.
+SlotMask LowSlots(const unsigned int count) {
+  if (count >= 8 * sizeof(SlotMask)) return static_cast<SlotMask>(~static_cast<SlotMask>(0));
+  return static_cast<SlotMask>((static_cast<SlotMask>(1) << count) - 1);
+}
+
+// Lowest set bit of a nonzero mask.
+unsigned int LowestSlot(const SlotMask mask) {
+  // The 64-bit builtin is a libgcc call on AVR.
+  if (sizeof(SlotMask) <= sizeof(unsigned int)) return __builtin_ctz(mask);
+  return __builtin_ctzll(mask);
+}
+
+// Rotates a mask of ring slots so that bit n is the slot n places after head.
+SlotMask FromHead(const SlotMask mask, const unsigned int head) {
+  if (head == 0) return mask;
+  return static_cast<SlotMask>((mask >> head) | (mask << (BUFFER_SIZE - head))) &
+    LowSlots(BUFFER_SIZE);
+}
+
+// The inverse of FromHead().
+SlotMask ToSlots(const SlotMask mask, const unsigned int head) {
+  if (head == 0) return mask;
+  return static_cast<SlotMask>((mask << head) | (mask >> (BUFFER_SIZE - head))) &
+    LowSlots(BUFFER_SIZE);
+}
+
+// Channels other than 0 need the extended header to carry their number.
+bool OffersExtendedHeader(const LinkConfig &config) {
+  return config.extended_header || config.channel != 0;
 }
 
-const int MAX_OUTGOING_INDEX_GAP = 15;
+// Bytes of settings in the start sequence packet: capabilities, then the
+// receive window, high byte first.
+const unsigned int START_SETTINGS_SIZE = 3;
 
 }  // namespace
 
-PacketRingBuffer::PacketRingBuffer() {
-  last_index_number_ = 0;
+PacketRingBuffer::PacketRingBuffer()
+  : window_size_(DEFAULT_WINDOW_SIZE), spare_slot_(false), max_index_(MAX_BASIC_INDEX) {
+  Clear();
+}
+
+void PacketRingBuffer::Configure(const unsigned int window_size, const unsigned int max_index,
+    const bool spare_slot) {
+  window_size_ = window_size < BUFFER_SIZE ? window_size : BUFFER_SIZE;
+  spare_slot_ = spare_slot && window_size_ < BUFFER_SIZE;
+  max_index_ = max_index;
 }
 
 bool PacketRingBuffer::full() const {
-  for (int i = 0; i < BUFFER_SIZE; ++i) {
-    if (!live_indices_[i]) return false;
-  }
-  return true;
+  return allocated_count_ >= window_size_ + (spare_slot_ ? 1 : 0);
 }
 
 Packet* PacketRingBuffer::AllocatePacket() {
   Cleanup();
-  int unused_index;
-  return AllocatePacketFromArray(BUFFER_SIZE, live_indices_, buffer_, &unused_index);
+  if (full()) return nullptr;
+  const unsigned int slot = LowestSlot(~allocated_ & LowSlots(BUFFER_SIZE));
+  allocated_ |= SlotBit(slot);
+  unplaced_ |= SlotBit(slot);
+  ++allocated_count_;
+  buffer_[slot].Reset();
+  return &buffer_[slot];
+}
+
+Packet* PacketRingBuffer::PeekPacket() {
+  Cleanup();
+  if (!(ring_live_ & SlotBit(head_))) return nullptr;
+  return &buffer_[ring_[head_]];
 }
 
 Packet* PacketRingBuffer::PopPacket() {
-  for (int i = 0; i < BUFFER_SIZE; ++i) {
-    if (live_indices_[i]) {
-      Packet &p = buffer_[i];
-      //printf("Parsed buffer_[%d].parsed = %d, index = %d, looking for: %d\n", i,
-      //    p.parsed(), p.index_sending(), NextIndex(last_index_number_));
-      if (p.parsed() && p.index_sending() == NextIndex(last_index_number_)) {
-        last_index_number_ = p.index_sending();
-        live_indices_[i] = false;
-        //printf("Popping\n");
-        return &buffer_[i];
-      }
-    }
-  }
-  return nullptr;
+  Cleanup();
+  if (!(ring_live_ & SlotBit(head_))) return nullptr;
+  const unsigned int slot = ring_[head_];
+  ring_live_ &= ~SlotBit(head_);
+  Free(slot);
+  head_ = (head_ + 1) % BUFFER_SIZE;
+  last_index_number_ = NextIndex(last_index_number_, max_index_);
+  return &buffer_[slot];
 }
 
 void PacketRingBuffer::Clear() {
-  for (int i = 0; i < BUFFER_SIZE; ++i) {
-    live_indices_[i] = false;
-  }
+  allocated_ = 0;
+  unplaced_ = 0;
+  allocated_count_ = 0;
+  ring_live_ = 0;
+  head_ = 0;
   last_index_number_ = 0;
 }
 
-bool PacketRingBuffer::InRange(const unsigned char index_sending) {
-  unsigned char test_index = last_index_number_;
-  for (int j = 0; j < BUFFER_SIZE; ++j) {
-    test_index = NextIndex(test_index);
-    if (test_index == index_sending) {
-      return true;
+unsigned int PacketRingBuffer::ReceivedInOrder() {
+  Cleanup();
+  const SlotMask missing = ~FromHead(ring_live_, head_) & LowSlots(BUFFER_SIZE);
+  return missing == 0 ? BUFFER_SIZE : LowestSlot(missing);
+}
+
+bool PacketRingBuffer::MissingBefore(const unsigned int index) {
+  return IndexDistance(last_index_number_, index, max_index_) > ReceivedInOrder() + 1;
+}
+
+Ack PacketRingBuffer::CumulativeAck() const {
+  Ack ack;
+  ack.Parse(false, last_index_number_);
+  return ack;
+}
+
+bool PacketRingBuffer::InRange(const unsigned int index_sending) const {
+  if (index_sending == 0 || index_sending > max_index_) return false;
+  const unsigned int distance = IndexDistance(last_index_number_, index_sending, max_index_);
+  return distance >= 1 && distance <= window_size_;
+}
+
+Ack PacketRingBuffer::SelectiveAck() {
+  Cleanup();
+  Ack ack;
+  ack.Parse(false, last_index_number_);
+  for (SlotMask held = FromHead(ring_live_, head_); held != 0; held &= held - 1) {
+    ack.SetSelective(LowestSlot(held));
+  }
+  return ack;
+}
+
+Ack PacketRingBuffer::ReceivedAck(const bool selective) {
+  const unsigned int received = ReceivedInOrder();
+  Ack ack;
+  ack.Parse(false, AdvanceIndex(last_index_number_, received, max_index_));
+  if (selective && received < BUFFER_SIZE) {
+    // Bit 0 is now the first packet missing.
+    for (SlotMask held = FromHead(ring_live_, head_) >> received; held != 0; held &= held - 1) {
+      ack.SetSelective(LowestSlot(held));
     }
   }
-  return false;
+  ack.SetCredit(window_size_ - received);
+  return ack;
 }
 
 void PacketRingBuffer::Cleanup() {
-  // Note that this is only called when allocating a packet, so there shouldn't
-  // be any incomplete packets in the list.
-  for (int i = 0; i < BUFFER_SIZE; ++i) {
-    Packet &p = buffer_[i];
-    if (!live_indices_[i]) continue;
-    if (p.error()) {
-      live_indices_[i] = false;
+  for (SlotMask unplaced = unplaced_; unplaced != 0; unplaced &= unplaced - 1) {
+    const unsigned int slot = LowestSlot(unplaced);
+    const Packet &p = buffer_[slot];
+    // Still being parsed.
+    if (!p.parsed() && !p.error()) continue;
+    unplaced_ &= ~SlotBit(slot);
+    if (p.error() || !InRange(p.index_sending())) {
+      Free(slot);
       continue;
     }
-    if (!InRange(p.index_sending())) {
-      live_indices_[i] = false;
+    const unsigned int position =
+      (head_ + IndexDistance(last_index_number_, p.index_sending(), max_index_) - 1) % BUFFER_SIZE;
+    if (ring_live_ & SlotBit(position)) {
+      TENSIXTY_TRACE(TRACE_DEBUG, TRACE_BUFFER, TRACE_BUFFER_DROP_DUPLICATE,
+          p.index_sending(), 0, 0);
+      Free(slot);
       continue;
     }
-    // Remove duplicates.
-    for (int j = i + 1; j < BUFFER_SIZE; ++j) {
-      if (live_indices_[j] && p.index_sending() == buffer_[j].index_sending()) {
-        printf("Cleanup Dropping %d\n", p.index_sending());
-        live_indices_[j] = false;
-        break;
-      }
+    ring_[position] = slot;
+    ring_live_ |= SlotBit(position);
+  }
+}
+
+void PacketRingBuffer::Free(const unsigned int slot) {
+  allocated_ &= ~SlotBit(slot);
+  --allocated_count_;
+}
+
+bool AckQueue::Push(const Ack &ack, const bool merge) {
+  // An ack for index 0 acks nothing, so it never stands in for a real one.
+  if (merge && count_ > 0 && ack.ok() && ack.index() != 0) {
+    Ack &last = acks_[(head_ + count_ - 1) % ACK_QUEUE_SIZE];
+    if (last.ok() && last.index() != 0) {
+      last = ack;
+      return true;
     }
   }
+  const bool plain = !ack.has_selective() && !ack.has_credit();
+  for (unsigned int i = 0; plain && i < count_; ++i) {
+    const Ack &queued = acks_[(head_ + i) % ACK_QUEUE_SIZE];
+    if (queued.index() == ack.index() && queued.error() == ack.error() &&
+        !queued.has_selective() && !queued.has_credit()) {
+      return true;
+    }
+  }
+  if (full()) return false;
+  acks_[(head_ + count_) % ACK_QUEUE_SIZE] = ack;
+  ++count_;
+  return true;
 }
 
-Reader::Reader(const int name, SerialInterface *serial)
-  : name_(name) {
+Ack AckQueue::Pop() {
+  Ack ack;
+  if (count_ == 0) return ack;
+  ack = acks_[head_];
+  head_ = (head_ + 1) % ACK_QUEUE_SIZE;
+  --count_;
+  return ack;
+}
+
+Reader::Reader(const int name, SerialInterface *serial, const LinkConfig &config)
+  : config_(config), name_(name) {
   serial_ = serial;
+  read_chunk_start_ = 0;
+  read_chunk_end_ = 0;
   current_packet_ = nullptr;
   sequence_started_ = false;
+  extended_header_ = false;
+  selective_ack_ = false;
+  cumulative_ack_ = false;
+  compact_ack_ = false;
+  credit_ = false;
+  batch_ = false;
+  credit_limit_ = 0;
+  cumulative_ack_pending_ = false;
+  cumulative_ack_urgent_ = false;
+  unacked_packets_ = 0;
+  ack_delay_started_ = false;
+  ack_delay_start_ = 0;
+  peer_window_size_ = DEFAULT_WINDOW_SIZE;
+  batch_offset_ = 0;
+  datagram_head_ = 0;
+  datagram_count_ = 0;
 }
 
 bool Reader::Read() {
-  //printf("Starting read.\n");
-  if (!serial_->available()) return false;
-  //printf("Got bytes.\n");
-  if (incoming_ack_.index() != 0) {
-    printf("%d: Reader waiting on incoming ack.\n", name_);
+  if (read_chunk_start_ == read_chunk_end_) {
+    read_chunk_start_ = 0;
+    read_chunk_end_ = serial_->read(read_chunk_, READ_CHUNK_SIZE);
+  }
+  size_t consumed;
+  const bool keep_reading = Read(read_chunk_ + read_chunk_start_,
+      read_chunk_end_ - read_chunk_start_, &consumed);
+  read_chunk_start_ += consumed;
+  return keep_reading;
+}
+
+bool Reader::Read(const unsigned char *buf, const size_t length, size_t *consumed) {
+  *consumed = 0;
+  if (length == 0) return false;
+  // A frame adds at most one ack each way.
+  if (incoming_acks_.full()) {
+    TENSIXTY_TRACE(TRACE_DEBUG, TRACE_READER, TRACE_READER_WAITING_INCOMING_ACK, name_, 0, 0);
     return false;
   }
-  if (outgoing_ack_.index() != 0) {
-    printf("%d: Reader waiting on outgoing ack.\n", name_);
+  if (outgoing_acks_.full()) {
+    TENSIXTY_TRACE(TRACE_DEBUG, TRACE_READER, TRACE_READER_WAITING_OUTGOING_ACK, name_, 0, 0);
     return false;
   }
-  //printf("Old acks flushed okay.\n");
   if (current_packet_ == nullptr) {
     current_packet_ = buffer_.AllocatePacket();
   }
   //printf("Allocated packet.\n");
   // No buffer space left.
   if (current_packet_ == nullptr) {
-    printf("%d: No buffer space left.\n", name_);
+    TENSIXTY_TRACE(TRACE_INFO, TRACE_READER, TRACE_READER_BUFFER_FULL, name_, 0, 0);
     return false;
   }
 
-  const ParseStatus status =
-    current_packet_->ParseChar(serial_->read());
+  return HandleParseStatus(current_packet_->Parse(buf, length, consumed));
+}
 
+bool Reader::HandleParseStatus(const ParseStatus status) {
   if (status == INCOMPLETE) return true;
   if (status == HEADER_ERROR) {
     current_packet_ = nullptr;
     return true;
   }
-  outgoing_ack_ = current_packet_->ack();
-  printf("%d: CC Outgoing ack: %d\n", name_, outgoing_ack_.Serialize());
+  const Ack &outgoing_ack = current_packet_->ack();
+  if (outgoing_ack.index() != 0 || outgoing_ack.has_selective() ||
+      outgoing_ack.is_start_sequence_ack()) {
+    // Each ack is handled on its own, so every one can time a round trip.
+    outgoing_acks_.Push(outgoing_ack);
+    TENSIXTY_TRACE(TRACE_DEBUG, TRACE_READER, TRACE_READER_OUTGOING_ACK,
+        name_, outgoing_ack.Serialize(), 0);
+  }
   if (!sequence_started_ && !current_packet_->start_sequence()) {
     current_packet_ = nullptr;
     buffer_.Clear();
-    printf("%d: Got bytes but not initialized yet.\n", name_);
+    batch_offset_ = 0;
+    TENSIXTY_TRACE(TRACE_INFO, TRACE_READER, TRACE_READER_NOT_INITIALIZED, name_, 0, 0);
   } else if (current_packet_->start_sequence()) {
-    incoming_ack_.AckStartSequence();
+    // Acks for the old sequence are moot.
+    Ack start_ack;
+    start_ack.AckStartSequence();
+    incoming_acks_.Clear();
+    incoming_acks_.Push(start_ack);
     buffer_.Clear();
+    batch_offset_ = 0;
+    AcceptPeerSettings(*current_packet_);
     sequence_started_ = true;
-    printf("%d: Reader sequence started.\n", name_);
+    TENSIXTY_TRACE(TRACE_INFO, TRACE_READER, TRACE_READER_SEQUENCE_STARTED, name_, 0, 0);
   } else {
+    if (status == PARSED && current_packet_->datagram()) AcceptDatagram(*current_packet_);
     if (status != PARSED) {
       if (current_packet_->index_sending() != 0) {
         // hacky -- if index is zero, then this would reset the link, which we don't want to do.
         // But something is probably wrong with parsing to get here.
-        incoming_ack_.Parse(true, current_packet_->index_sending());
+        Ack error_ack;
+        error_ack.Parse(true, current_packet_->index_sending());
+        incoming_acks_.Push(error_ack);
       } else {
-        printf("WARNING: Parsed header of packet that looks broken.\n");
+        TENSIXTY_TRACE(TRACE_ERROR, TRACE_READER, TRACE_READER_BROKEN_HEADER, name_, 0, 0);
       }
+    } else if (cumulative_ack_) {
+      const unsigned int index = current_packet_->index_sending();
+      if (index == 0) {
+        // Only carries an ack, which needs none back.
+      } else if (!buffer_.InRange(index)) {
+        // Already popped, so our ack was lost or late. Repeat it right away.
+        cumulative_ack_pending_ = true;
+        cumulative_ack_urgent_ = true;
+      } else if (selective_ack_ || credit_) {
+        // Reports this packet. One after a gap tells the other end what was
+        // lost, so it goes right away.
+        cumulative_ack_pending_ = true;
+        if (credit_) ++unacked_packets_;
+        if (selective_ack_ && buffer_.MissingBefore(index)) cumulative_ack_urgent_ = true;
+      }
+    } else if (current_packet_->index_sending() == 0) {
+      // An ack-only frame or a datagram, which needs no ack back.
     } else if (!buffer_.InRange(current_packet_->index_sending())) {
       // Acks out of order packets. We already received these, but the
       // ack reply must have been corrupted.
       //
       // This could be a problem if we ack a future packet we're throwing away,
       // but the other end shouldn't be sending those until acked close to it.
-      incoming_ack_.Parse(false, current_packet_->index_sending());
+      Ack repeat_ack;
+      repeat_ack.Parse(false, current_packet_->index_sending());
+      incoming_acks_.Push(repeat_ack, true);
     }
     // Can't ack if parsed, since it may be out of order. We'll ack on pop().
   }
@@ -183,267 +375,817 @@ bool Reader::Read() {
   return true;
 }
 
+void Reader::AcceptPeerSettings(const Packet &start_packet) {
+  // Peers that predate negotiation send no settings.
+  unsigned char length;
+  const unsigned char *settings = start_packet.data(&length);
+  const unsigned char capabilities = length >= 1 ? settings[0] : 0;
+  peer_window_size_ = length >= START_SETTINGS_SIZE ?
+    (static_cast<unsigned int>(settings[1]) << 8) | settings[2] : DEFAULT_WINDOW_SIZE;
+  extended_header_ = OffersExtendedHeader(config_) && (capabilities & CAPABILITY_EXTENDED_HEADER);
+  selective_ack_ = extended_header_ && config_.selective_ack &&
+    (capabilities & CAPABILITY_SELECTIVE_ACK);
+  cumulative_ack_ = selective_ack_ ||
+    (config_.cumulative_ack && (capabilities & CAPABILITY_CUMULATIVE_ACK));
+  compact_ack_ = config_.compact_ack && (capabilities & CAPABILITY_COMPACT_ACK);
+  credit_ = extended_header_ && config_.credit && (capabilities & CAPABILITY_CREDIT);
+  batch_ = config_.batch && (capabilities & CAPABILITY_BATCH);
+  cumulative_ack_ = cumulative_ack_ || credit_;
+  cumulative_ack_pending_ = false;
+  cumulative_ack_urgent_ = false;
+  unacked_packets_ = 0;
+  ack_delay_started_ = false;
+  const unsigned int max_index = extended_header_ ? MAX_EXTENDED_INDEX : MAX_BASIC_INDEX;
+  const unsigned int window_size = ClampWindowSize(config_.window_size, max_index);
+  // With credit, packets are acked before they are popped, so a full window
+  // must still leave a slot to parse the other end's acks in.
+  buffer_.Configure(credit_ && window_size == BUFFER_SIZE ? window_size - 1 : window_size,
+      max_index, credit_);
+  credit_limit_ = buffer_.window_size();
+}
+
+void Reader::AcceptDatagram(const Packet &p) {
+#if TENSIXTY_MAX_DATAGRAMS == 0
+  unsigned char dropped_length;
+  p.data(&dropped_length);
+  TENSIXTY_TRACE(TRACE_DEBUG, TRACE_READER, TRACE_READER_DATAGRAM, name_, dropped_length, 1);
+#else
+  const bool full = datagram_count_ == MAX_DATAGRAMS;
+  if (full) {
+    datagram_head_ = (datagram_head_ + 1) % MAX_DATAGRAMS;
+    --datagram_count_;
+  }
+  const unsigned int slot = (datagram_head_ + datagram_count_) % MAX_DATAGRAMS;
+  unsigned char length;
+  const unsigned char *data = p.data(&length);
+  memcpy(datagrams_[slot], data, length);
+  datagram_lengths_[slot] = length;
+  ++datagram_count_;
+  TENSIXTY_TRACE(TRACE_DEBUG, TRACE_READER, TRACE_READER_DATAGRAM, name_, length, full);
+#endif
+}
+
+const unsigned char* Reader::PopDatagram(unsigned char *length) {
+  if (datagram_count_ == 0) {
+    *length = 0;
+    return nullptr;
+  }
+#if TENSIXTY_MAX_DATAGRAMS == 0
+  return nullptr;
+#else
+  const unsigned int slot = datagram_head_;
+  datagram_head_ = (datagram_head_ + 1) % MAX_DATAGRAMS;
+  --datagram_count_;
+  *length = datagram_lengths_[slot];
+  return datagrams_[slot];
+#endif
+}
+
+Packet* Reader::PeekPacket() {
+  return buffer_.PeekPacket();
+}
+
+const unsigned char* Reader::PopBatchedMessage(unsigned char *length) {
+  Packet *p = buffer_.PeekPacket();
+  if (p == nullptr) {
+    *length = 0;
+    return nullptr;
+  }
+  unsigned char packet_length;
+  const unsigned char *data = p->data(&packet_length);
+  const unsigned int offset = batch_offset_;
+  const unsigned int message_length = offset < packet_length ? data[offset] : 0;
+  batch_offset_ += 1 + message_length;
+  // Clears batch_offset_ for the next packet.
+  if (batch_offset_ >= packet_length) PopPacket();
+  // A record running past the packet, or none at all, is malformed.
+  if (offset + 1 + message_length > packet_length) {
+    *length = 0;
+    return nullptr;
+  }
+  *length = message_length;
+  return data + offset + 1;
+}
+
 Packet* Reader::PopPacket() {
   Packet *packet = buffer_.PopPacket();
   if (packet != nullptr) {
-    // TODO: Problem is that if we've already popped, we'll never ack a retry.
-    incoming_ack_.Parse(false, packet->index_sending());
+    batch_offset_ = 0;
+    if (credit_) {
+      // Its arrival was acked already. The space it frees is only worth an
+      // ack of its own once the other end is down to half its credit.
+      const unsigned int received = AdvanceIndex(
+          packet->index_sending(), buffer_.ReceivedInOrder(), MAX_EXTENDED_INDEX);
+      if (IndexDistance(received, credit_limit_, MAX_EXTENDED_INDEX) * 2 <= buffer_.window_size()) {
+        cumulative_ack_pending_ = true;
+      }
+    } else if (cumulative_ack_) {
+      cumulative_ack_pending_ = true;
+      ++unacked_packets_;
+    } else {
+      // TODO: Problem is that if we've already popped, we'll never ack a retry.
+      Ack ack;
+      ack.Parse(false, packet->index_sending());
+      // As before, the newest ack stands for the ones before it; the other
+      // end resends anything it skips.
+      incoming_acks_.Push(ack, true);
+    }
   }
   return packet;
 }
 
 Ack Reader::PopIncomingAck() {
-  Ack ack = incoming_ack_;
-  incoming_ack_.Parse(0x00);
+  Ack ack = incoming_acks_.Pop();
+  // Start sequence acks and error acks go first; a cumulative ack describes
+  // the whole buffer, so it can wait for the next packet.
+  if (ack.index() == 0 && !ack.is_start_sequence_ack() && cumulative_ack_pending_) {
+    if (credit_) {
+      ack = buffer_.ReceivedAck(selective_ack_);
+      credit_limit_ = AdvanceIndex(ack.index(), ack.credit(), MAX_EXTENDED_INDEX);
+    } else {
+      ack = selective_ack_ ? buffer_.SelectiveAck() : buffer_.CumulativeAck();
+    }
+    cumulative_ack_pending_ = false;
+    cumulative_ack_urgent_ = false;
+    unacked_packets_ = 0;
+    ack_delay_started_ = false;
+  }
   return ack;
 }
 
+bool Reader::IncomingAckDue(const unsigned long now) {
+  if (!incoming_acks_.empty()) return true;
+  if (!cumulative_ack_pending_) return false;
+  if (cumulative_ack_urgent_ || unacked_packets_ >= config_.ack_every_packets) return true;
+  if (!ack_delay_started_) {
+    ack_delay_started_ = true;
+    ack_delay_start_ = now;
+  }
+  return now - ack_delay_start_ >= config_.ack_delay_micros;
+}
+
+bool Reader::IncomingAckDeadline(const unsigned long now, unsigned long *deadline) const {
+  if (!incoming_acks_.empty() || (cumulative_ack_pending_ &&
+      (cumulative_ack_urgent_ || unacked_packets_ >= config_.ack_every_packets))) {
+    *deadline = now;
+    return true;
+  }
+  if (!cumulative_ack_pending_) return false;
+  // The wait starts with the next write, if it has not yet.
+  *deadline = (ack_delay_started_ ? ack_delay_start_ : now) + config_.ack_delay_micros;
+  return true;
+}
+
+bool Reader::HasInput() {
+  return read_chunk_start_ != read_chunk_end_ || serial_->available();
+}
+
 Ack Reader::PopOutgoingAck() {
-  Ack ack = outgoing_ack_;
-  outgoing_ack_.Parse(0x00);
-  return ack;
+  return outgoing_acks_.Pop();
 }
 
-OutgoingPacketBuffer::OutgoingPacketBuffer(int name) {
-  earliest_sent_index_ = 0x80;
-  for (int i = 0; i < BUFFER_SIZE; ++i) {
-    live_indices_[i] = false;
-    pending_indices_[i] = false;
+OutgoingPacketBuffer::OutgoingPacketBuffer(int name)
+  : window_size_(DEFAULT_WINDOW_SIZE), max_index_(MAX_BASIC_INDEX),
+    credit_limited_(false), credit_limit_(0) {
+  live_ = 0;
+  pending_ = 0;
+  selective_acked_ = 0;
+  keyed_ = 0;
+  for (unsigned int i = 0; i < BUFFER_SIZE; ++i) {
+    sent_time_[i] = 0;
+    send_count_[i] = 0;
   }
-  sequence_started_ = false;
+  head_ = 0;
+  used_ = 0;
   name_ = name;
 }
 
-Packet* OutgoingPacketBuffer::AllocatePacket() {
-  int index;
-  Packet* p = AllocatePacketFromArray(BUFFER_SIZE, live_indices_, buffer_, &index);
-  if (p != nullptr) {
-    pending_indices_[index] = true;
+void OutgoingPacketBuffer::Configure(const unsigned int window_size, const unsigned int max_index) {
+  window_size_ = window_size < BUFFER_SIZE ? window_size : BUFFER_SIZE;
+  max_index_ = max_index;
+}
+
+Packet* OutgoingPacketBuffer::AllocatePacket(const int supersede_key) {
+  if (used_ >= window_size_) return nullptr;
+  const unsigned int slot = (head_ + used_) % BUFFER_SIZE;
+  ++used_;
+  live_ |= SlotBit(slot);
+  pending_ |= SlotBit(slot);
+  selective_acked_ &= ~SlotBit(slot);
+  if (supersede_key == NO_SUPERSEDE_KEY) {
+    keyed_ &= ~SlotBit(slot);
+  } else {
+    keyed_ |= SlotBit(slot);
+    supersede_key_[slot] = supersede_key;
   }
-  return p;
+  send_count_[slot] = 0;
+  buffer_[slot].Reset();
+  return &buffer_[slot];
 }
 
-void OutgoingPacketBuffer::MarkSent(const unsigned char index) {
-  for (int i = 0; i < BUFFER_SIZE; ++i) {
-    if (live_indices_[i] && (buffer_[i].index_sending() == index)) {
-      pending_indices_[i] = false;
-    }
+Packet* OutgoingPacketBuffer::UnsentPacket(const int supersede_key) {
+  for (SlotMask keyed = live_ & keyed_; keyed != 0; keyed &= keyed - 1) {
+    const unsigned int slot = LowestSlot(keyed);
+    if (supersede_key_[slot] == supersede_key) return &buffer_[slot];
   }
+  return nullptr;
 }
 
-void OutgoingPacketBuffer::MarkResend(const unsigned char index) {
-  for (int i = 0; i < BUFFER_SIZE; ++i) {
-    if (live_indices_[i] && (buffer_[i].index_sending() == index)) {
-      printf("%d: Found packet %d. Marking resend.\n", name_, index);
-      pending_indices_[i] = true;
-    }
+int OutgoingPacketBuffer::SlotOf(const unsigned int index) const {
+  if (used_ == 0) return -1;
+  const unsigned int distance =
+    IndexDistance(buffer_[head_].index_sending(), index, max_index_);
+  if (distance >= used_) return -1;
+  const unsigned int slot = (head_ + distance) % BUFFER_SIZE;
+  if (!(live_ & SlotBit(slot)) || buffer_[slot].index_sending() != index) return -1;
+  return slot;
+}
+
+void OutgoingPacketBuffer::Release(const SlotMask slots) {
+  live_ &= ~slots;
+  pending_ &= ~slots;
+  selective_acked_ &= ~slots;
+  if (live_ == 0) {
+    used_ = 0;
+    return;
   }
+  const unsigned int freed = LowestSlot(FromHead(live_, head_));
+  head_ = (head_ + freed) % BUFFER_SIZE;
+  used_ -= freed;
 }
 
-void OutgoingPacketBuffer::MarkAllResend() {
-  for (int i = 0; i < BUFFER_SIZE; ++i) {
-    if (live_indices_[i]) {
-      pending_indices_[i] = true;
-      printf("%d: Resend buffer[%d] = index %d. Next index = %d\n",
-          name_, i, buffer_[i].index_sending(), earliest_sent_index_);
-    }
+SlotMask OutgoingPacketBuffer::Outstanding() const {
+  return live_ & ~pending_ & ~selective_acked_;
+}
+
+void OutgoingPacketBuffer::MarkSent(const unsigned int index, const unsigned long now) {
+  const int slot = SlotOf(index);
+  if (slot < 0) return;
+  pending_ &= ~SlotBit(slot);
+  keyed_ &= ~SlotBit(slot);
+  sent_time_[slot] = now;
+  if (send_count_[slot] < 255) ++send_count_[slot];
+}
+
+bool OutgoingPacketBuffer::SentOnce(const unsigned int index, unsigned long *sent_time) const {
+  const int slot = SlotOf(index);
+  if (slot < 0) return false;
+  *sent_time = sent_time_[slot];
+  return send_count_[slot] == 1;
+}
+
+unsigned int OutgoingPacketBuffer::SendCount(const unsigned int index) const {
+  const int slot = SlotOf(index);
+  return slot < 0 ? 0 : send_count_[slot];
+}
+
+void OutgoingPacketBuffer::MarkResend(const unsigned int index) {
+  const int slot = SlotOf(index);
+  if (slot < 0) return;
+  TENSIXTY_TRACE(TRACE_DEBUG, TRACE_BUFFER, TRACE_BUFFER_MARK_RESEND, name_, index, 0);
+  pending_ |= SlotBit(slot);
+}
+
+bool OutgoingPacketBuffer::MarkAllResend() {
+  const SlotMask resend = live_ & ~selective_acked_;
+  for (SlotMask traced = resend; traced != 0; traced &= traced - 1) {
+    TENSIXTY_TRACE(TRACE_DEBUG, TRACE_BUFFER, TRACE_BUFFER_RESEND,
+        name_, buffer_[LowestSlot(traced)].index_sending(), 0);
   }
+  pending_ |= resend;
+  return resend != 0;
 }
 
-Packet* OutgoingPacketBuffer::PeekResendPacket() {
-  for (int i = 0; i < BUFFER_SIZE; ++i) {
-    if (live_indices_[i] && pending_indices_[i]) {
-      pending_indices_[i] = false;
-      return &buffer_[i];
-    }
+bool OutgoingPacketBuffer::MarkExpired(const unsigned long now, const unsigned long rto) {
+  bool marked = false;
+  for (SlotMask waiting = Outstanding(); waiting != 0; waiting &= waiting - 1) {
+    const unsigned int slot = LowestSlot(waiting);
+    if (send_count_[slot] == 0 || now - sent_time_[slot] < rto) continue;
+    pending_ |= SlotBit(slot);
+    marked = true;
+    TENSIXTY_TRACE(TRACE_DEBUG, TRACE_BUFFER, TRACE_BUFFER_RESEND,
+        name_, buffer_[slot].index_sending(), send_count_[slot]);
   }
-  return nullptr;
+  return marked;
 }
 
-Packet* OutgoingPacketBuffer::PeekPacket(const unsigned char index) {
-  for (int i = 0; i < BUFFER_SIZE; ++i) {
-    if (live_indices_[i] && buffer_[i].index_sending() == index) {
-      return &buffer_[i];
+bool OutgoingPacketBuffer::OldestSendTime(const unsigned long now, unsigned long *sent_time) const {
+  bool found = false;
+  unsigned long oldest_elapsed = 0;
+  for (SlotMask waiting = Outstanding(); waiting != 0; waiting &= waiting - 1) {
+    const unsigned int slot = LowestSlot(waiting);
+    if (send_count_[slot] == 0) continue;
+    const unsigned long elapsed = now - sent_time_[slot];
+    if (!found || elapsed > oldest_elapsed) {
+      *sent_time = sent_time_[slot];
+      oldest_elapsed = elapsed;
+      found = true;
     }
   }
-  return nullptr;
+  return found;
+}
+
+Packet* OutgoingPacketBuffer::PeekResendPacket() {
+  const SlotMask resend = FromHead(live_ & pending_, head_);
+  if (resend == 0) return nullptr;
+  const unsigned int slot = (head_ + LowestSlot(resend)) % BUFFER_SIZE;
+  pending_ &= ~SlotBit(slot);
+  return &buffer_[slot];
+}
+
+Packet* OutgoingPacketBuffer::PeekPacket(const unsigned int index) {
+  const int slot = SlotOf(index);
+  return slot < 0 ? nullptr : &buffer_[slot];
 }
 
 Packet* OutgoingPacketBuffer::NextPacket() {
-  UpdateNextIndex();
-  unsigned char next_index = earliest_sent_index_;
-  for (int j = 0; j < MAX_OUTGOING_INDEX_GAP; ++j) {
-    for (int i = 0; i < BUFFER_SIZE; ++i) {
-      if (live_indices_[i] && pending_indices_[i] &&
-          buffer_[i].index_sending() == next_index) {
-        return &buffer_[i];
-      }
-    }
-    IncrementIndex(&next_index);
+  return CreditBlocked() ? nullptr : ProbePacket();
+}
+
+Packet* OutgoingPacketBuffer::ProbePacket() {
+  // The oldest pending packet.
+  const SlotMask pending = FromHead(live_ & pending_, head_);
+  if (pending == 0) return nullptr;
+  return &buffer_[(head_ + LowestSlot(pending)) % BUFFER_SIZE];
+}
+
+bool OutgoingPacketBuffer::CreditBlocked() const {
+  if (!credit_limited_) return false;
+  const SlotMask pending = FromHead(live_ & pending_, head_);
+  if (pending == 0) return false;
+  // Indices are consecutive, so everything after it is past the limit too.
+  const Packet &oldest = buffer_[(head_ + LowestSlot(pending)) % BUFFER_SIZE];
+  return IndexAfter(oldest.index_sending(), credit_limit_, max_index_);
+}
+
+void OutgoingPacketBuffer::RemovePacket(const unsigned int index) {
+  const int slot = SlotOf(index);
+  TENSIXTY_TRACE(TRACE_DEBUG, TRACE_BUFFER, TRACE_BUFFER_REMOVED, name_, index, slot >= 0);
+  if (slot < 0) return;
+  // Anything older was lost or its ack was.
+  const SlotMask earlier =
+    ToSlots(LowSlots((slot + BUFFER_SIZE - head_) % BUFFER_SIZE), head_) & live_;
+  for (SlotMask traced = earlier; traced != 0; traced &= traced - 1) {
+    TENSIXTY_TRACE(TRACE_INFO, TRACE_BUFFER, TRACE_BUFFER_MISORDERED,
+        name_, buffer_[LowestSlot(traced)].index_sending(), 0);
   }
-  return nullptr;
+  pending_ |= earlier;
+  Release(SlotBit(slot));
 }
 
-bool OutgoingPacketBuffer::PrecedesIndex(unsigned char packet_index, const unsigned char sent_index) const {
-  for (int i = 0; i < MAX_OUTGOING_INDEX_GAP; ++i) {
-    IncrementIndex(&packet_index);
-    if (packet_index == sent_index) {
-      return true;
-    }
+void OutgoingPacketBuffer::AckThrough(const unsigned int index) {
+  if (index == 0 || used_ == 0) return;
+  const unsigned int distance =
+    IndexDistance(buffer_[head_].index_sending(), index, max_index_);
+  // Already acked, or never sent.
+  if (distance >= used_) return;
+  const SlotMask acked = ToSlots(LowSlots(distance + 1), head_) & live_;
+  for (SlotMask traced = acked; traced != 0; traced &= traced - 1) {
+    TENSIXTY_TRACE(TRACE_DEBUG, TRACE_BUFFER, TRACE_BUFFER_REMOVED,
+        name_, buffer_[LowestSlot(traced)].index_sending(), true);
   }
-  return false;
+  Release(acked);
 }
 
-void OutgoingPacketBuffer::RemovePacket(const unsigned char index) {
-  bool removed = false;
-  for (int i = 0; i < BUFFER_SIZE; ++i) {
-    if (live_indices_[i] && buffer_[i].index_sending() == index) {
-      live_indices_[i] = false;
-      pending_indices_[i] = false;
-      removed = true;
+void OutgoingPacketBuffer::MarkSelective(const Ack &ack) {
+  if (used_ == 0) return;
+  // Bit in the ack for the oldest packet held.
+  const unsigned int head_distance =
+    IndexDistance(ack.index(), buffer_[head_].index_sending(), max_index_);
+  if (head_distance == 0) return;
+  // Ring offset of the furthest newly acked packet.
+  bool newly_acked = false;
+  unsigned int furthest = 0;
+  for (SlotMask unacked = FromHead(live_ & ~selective_acked_, head_); unacked != 0;
+       unacked &= unacked - 1) {
+    const unsigned int offset = LowestSlot(unacked);
+    if (ack.selective(head_distance - 1 + offset)) {
+      const SlotMask bit = SlotBit((head_ + offset) % BUFFER_SIZE);
+      selective_acked_ |= bit;
+      pending_ &= ~bit;
+      furthest = offset;
+      newly_acked = true;
     }
   }
-  printf("%d: Removed packet %d = %d\n", name_, index, removed);
-  if (!removed) return;
-  for (int i = 0; i < BUFFER_SIZE; ++i) {
-    if (live_indices_[i] && PrecedesIndex(buffer_[i].index_sending(), index)) {
-      printf("%d: misordering found %d.\n", name_, buffer_[i].index_sending());
-      pending_indices_[i] = true;
-    }
+  if (!newly_acked) return;
+  // Anything still unacked before it was lost. Acks that bring no news do not
+  // trigger this again, so each gap is resent once per new report.
+  const SlotMask gaps = ToSlots(LowSlots(furthest), head_) & live_ & ~selective_acked_;
+  for (SlotMask traced = gaps; traced != 0; traced &= traced - 1) {
+    TENSIXTY_TRACE(TRACE_DEBUG, TRACE_BUFFER, TRACE_BUFFER_MARK_RESEND,
+        name_, buffer_[LowestSlot(traced)].index_sending(), 0);
   }
-  UpdateNextIndex();
+  pending_ |= gaps;
 }
 
 void OutgoingPacketBuffer::MarkSequenceStarted() {
-  sequence_started_ = true;
-  earliest_sent_index_ = 1;
+  Release(live_);
+  head_ = 0;
+  credit_limited_ = false;
 }
 
-void OutgoingPacketBuffer::UpdateNextIndex() {
-  if (!sequence_started_) {
-    earliest_sent_index_ = 0x80;
-  }
-  unsigned char next_index = earliest_sent_index_;
-  for (int j = 0; j < MAX_OUTGOING_INDEX_GAP; ++j) {
-    for (int i = 0; i < BUFFER_SIZE; ++i) {
-      if (live_indices_[i] && buffer_[i].index_sending() == next_index) {
-        earliest_sent_index_ = next_index;
-        return;
+void OutgoingPacketBuffer::SetCredit(const unsigned int ack, const unsigned int credit) {
+  const unsigned int limit = AdvanceIndex(ack, credit, max_index_);
+  if (credit_limited_) {
+    // Probes sent past the old limit were dropped; resend any the new one
+    // lets through.
+    for (SlotMask sent = Outstanding(); sent != 0; sent &= sent - 1) {
+      const unsigned int slot = LowestSlot(sent);
+      const unsigned int index = buffer_[slot].index_sending();
+      if (IndexAfter(index, credit_limit_, max_index_) &&
+          !IndexAfter(index, limit, max_index_)) {
+        pending_ |= SlotBit(slot);
       }
     }
-    IncrementIndex(&next_index);
   }
+  credit_limited_ = true;
+  credit_limit_ = limit;
 }
 
-Writer::Writer(const int name, const Clock &clock, SerialInterface *serial_interface, AckProvider *reader)
-  : buffer_(name), name_(name) {
+Writer::Writer(const int name, const Clock &clock, SerialInterface *serial_interface, AckProvider *reader,
+    const LinkConfig &config)
+  : buffer_(name), config_(config),
+    rtt_(config.initial_rto_micros, config.min_rto_micros, config.max_rto_micros),
+    name_(name) {
   serial_interface_ = serial_interface;
   reader_ = reader;
   current_index_ = 0;
+  max_index_ = MAX_BASIC_INDEX;
+  extended_header_ = false;
+  selective_ack_ = false;
+  cumulative_ack_ = false;
+  credit_ = false;
+  batch_ = false;
+  batch_length_ = 0;
+  batch_started_ = 0;
+  last_frame_size_ = 0;
+  last_data_sent_ = 0;
   clock_ = &clock;
-  last_send_time_ = clock_->micros();
+  start_acked_ = false;
   sequence_started_ = false;
+  datagram_head_ = 0;
+  datagram_count_ = 0;
   {
-    // Send the initialization packet.
+    // Send the initialization packet, offering our settings. With credit the
+    // reader keeps a slot spare, so it offers one less. Channels other than 0
+    // always use the extended header, and flag their start sequence.
+    const unsigned int max_window = config_.credit ? BUFFER_SIZE - 1 : BUFFER_SIZE;
+    const unsigned int window_size = config_.window_size < max_window ?
+      config_.window_size : max_window;
+    const unsigned char settings[START_SETTINGS_SIZE] = {
+      static_cast<unsigned char>((OffersExtendedHeader(config_) ? CAPABILITY_EXTENDED_HEADER : 0) |
+                                 (config_.selective_ack ? CAPABILITY_SELECTIVE_ACK : 0) |
+                                 (config_.cumulative_ack ? CAPABILITY_CUMULATIVE_ACK : 0) |
+                                 (config_.compact_ack ? CAPABILITY_COMPACT_ACK : 0) |
+                                 (config_.credit ? CAPABILITY_CREDIT : 0) |
+                                 (config_.batch ? CAPABILITY_BATCH : 0)),
+      static_cast<unsigned char>(window_size >> 8),
+      static_cast<unsigned char>(window_size & 0xff),
+    };
     Packet* p = buffer_.AllocatePacket();
-    p->IncludeData(0x80, nullptr, 0);
+    if (config_.channel == 0) {
+      p->IncludeData(0x80, settings, START_SETTINGS_SIZE);
+    } else {
+      p->UseExtendedHeader(true);
+      p->UseChannel(config_.channel);
+      p->IncludeData(0, settings, START_SETTINGS_SIZE);
+      p->MarkStartSequence();
+    }
   }
 }
 
-unsigned char Writer::NextIndex() {
-  IncrementIndex(&current_index_);
+unsigned int Writer::NextIndex() {
+  current_index_ = tensixty::NextIndex(current_index_, max_index_);
   return current_index_;
 }
 
+void Writer::StartSequence() {
+  TENSIXTY_TRACE(TRACE_INFO, TRACE_WRITER, TRACE_WRITER_SEQUENCE_STARTED, name_, 0, 0);
+  sequence_started_ = true;
+  extended_header_ = reader_->ExtendedHeader();
+  selective_ack_ = reader_->SelectiveAck();
+  cumulative_ack_ = reader_->CumulativeAck();
+  credit_ = reader_->Credit();
+  batch_ = reader_->Batch();
+  max_index_ = extended_header_ ? MAX_EXTENDED_INDEX : MAX_BASIC_INDEX;
+  const unsigned int window_size = config_.window_size < reader_->PeerWindowSize() ?
+    config_.window_size : reader_->PeerWindowSize();
+  buffer_.Configure(ClampWindowSize(window_size, max_index_), max_index_);
+  buffer_.MarkSequenceStarted();
+  // Until the first ack, the other end has room for its whole window.
+  if (credit_) buffer_.SetCredit(0, reader_->PeerWindowSize());
+}
+
 bool Writer::AddToOutgoingQueue(const unsigned char *data,
-    const unsigned int length) {
+    const unsigned int length, const int supersede_key) {
+  return AddToOutgoingQueue(nullptr, 0, data, length, supersede_key);
+}
+
+bool Writer::AddToOutgoingQueue(const unsigned char *header, const unsigned int header_length,
+    const unsigned char *data, const unsigned int length, const int supersede_key) {
+  const unsigned char *pieces[2] = {header, data};
+  const unsigned int lengths[2] = {header_length, length};
+  return QueuePieces(pieces, lengths, 2, supersede_key);
+}
+
+bool Writer::QueuePieces(const unsigned char *const *pieces, const unsigned int *lengths,
+    const unsigned int count, const int supersede_key) {
   if (!sequence_started_) return false;
-  Packet* p = buffer_.AllocatePacket();
+  if (supersede_key != NO_SUPERSEDE_KEY) {
+    Packet *queued = buffer_.UnsentPacket(supersede_key);
+    if (queued != nullptr) {
+      queued->IncludeData(queued->index_sending(), pieces, lengths, count);
+      TENSIXTY_TRACE(TRACE_DEBUG, TRACE_WRITER, TRACE_WRITER_SUPERSEDED,
+          name_, queued->index_sending(), 0);
+      return true;
+    }
+  }
+  Packet* p = buffer_.AllocatePacket(supersede_key);
   if (p == nullptr) return false;
-  p->IncludeData(NextIndex(), data, length);
-  printf("%d: Adding packet %d\n", name_, p->index_sending());
+  p->UseExtendedHeader(extended_header_);
+  p->UseChannel(config_.channel);
+  p->IncludeData(NextIndex(), pieces, lengths, count);
+  TENSIXTY_TRACE(TRACE_DEBUG, TRACE_WRITER, TRACE_WRITER_QUEUED, name_, p->index_sending(), 0);
+  return true;
+}
+
+bool Writer::AddMessage(const unsigned char *data, const unsigned int length,
+    const int supersede_key) {
+  return AddMessage(nullptr, 0, data, length, supersede_key);
+}
+
+bool Writer::AddMessage(const unsigned char *header, const unsigned int header_length,
+    const unsigned char *data, const unsigned int length, const int supersede_key) {
+  if (!batch_) return AddToOutgoingQueue(header, header_length, data, length, supersede_key);
+  const unsigned int total = header_length + length;
+  if (total >= MAX_DATA_SIZE) return false;
+  // Superseding replaces a whole packet, so those messages go alone, as do
+  // any too long to batch. Either way they follow the batch so far.
+  const bool alone = supersede_key != NO_SUPERSEDE_KEY || 1 + total > MAX_BATCH_SIZE;
+  if ((alone || batch_length_ + 1 + total > MAX_BATCH_SIZE) && !FlushBatch()) return false;
+  if (alone) return AddRecord(header, header_length, data, length, supersede_key);
+  if (batch_length_ == 0) batch_started_ = clock_->micros();
+  batch_buffer_[batch_length_++] = total;
+  if (header_length > 0) memcpy(batch_buffer_ + batch_length_, header, header_length);
+  batch_length_ += header_length;
+  memcpy(batch_buffer_ + batch_length_, data, length);
+  batch_length_ += length;
+  return true;
+}
+
+bool Writer::AddRecord(const unsigned char *header, const unsigned int header_length,
+    const unsigned char *data, const unsigned int length, const int supersede_key) {
+  // Written straight into the packet, without a record on the stack.
+  const unsigned char record_length = header_length + length;
+  const unsigned char *pieces[3] = {&record_length, header, data};
+  const unsigned int lengths[3] = {1, header_length, length};
+  return QueuePieces(pieces, lengths, 3, supersede_key);
+}
+
+bool Writer::FlushBatch() {
+  if (batch_length_ == 0) return true;
+  if (!AddToOutgoingQueue(batch_buffer_, batch_length_)) return false;
+  batch_length_ = 0;
   return true;
 }
 
 bool Writer::Write() {
+  HandleAcks();
+  if (!WriteFrame(true)) return false;
+  // Burst while there is budget and room, so a full window need not wait
+  // for the next call.
+  unsigned int spent = last_frame_size_;
+  while (spent < config_.write_budget_bytes && HasDataToSend() &&
+         serial_interface_->available_for_write() >= NextFrameSize()) {
+    if (!WriteFrame(true)) break;
+    spent += last_frame_size_;
+  }
+  return true;
+}
+
+unsigned int Writer::NextFrameSize() {
+  unsigned int length;
+#if TENSIXTY_MAX_DATAGRAMS > 0
+  const Packet *p =
+      datagram_count_ > 0 ? &datagrams_[datagram_head_] : NextDataPacket();
+#else
+  const Packet *p = NextDataPacket();
+#endif
+  if (p == nullptr) return 0;
+  p->frame(&length);
+  return length + MAX_SACK_BYTES + CREDIT_SIZE;
+}
+
+void Writer::HandleAcks() {
   // 1) Pick packet to write:
-  // 1a) handle outgoing acks
-  Ack outgoing_ack = reader_->PopOutgoingAck();
-  if (outgoing_ack.index() != 0) {
-    printf("%d: Got ack for %d.\n", name_, outgoing_ack.index());
-    if (outgoing_ack.error()) {
-      buffer_.MarkResend(outgoing_ack.index());
-      printf("%d: Mark resend %d.\n", name_, outgoing_ack.index());
-    } else {
-      printf("%d: Remove Sent Packet %d.\n", name_, outgoing_ack.index());
-      buffer_.RemovePacket(outgoing_ack.index());
+  // 1a) handle outgoing acks, all that were read since the last write
+  for (;;) {
+    const Ack outgoing_ack = reader_->PopOutgoingAck();
+    if (outgoing_ack.index() == 0 && !outgoing_ack.has_selective() &&
+        !outgoing_ack.is_start_sequence_ack()) {
+      break;
     }
-  } else if (outgoing_ack.is_start_sequence_ack()) {
-    printf("%d: Writer sequence started.\n", name_);
-    sequence_started_ = true;
+    HandleAck(outgoing_ack);
+  }
+  if (start_acked_ && !sequence_started_ && reader_->PeerSettingsKnown()) {
+    StartSequence();
+  }
+  if (batch_length_ > 0 && clock_->micros() - batch_started_ >= config_.batch_delay_micros) {
+    FlushBatch();
+  }
+  // 1e) resend packets whose own timers expired.
+  if (buffer_.MarkExpired(clock_->micros(), rtt_.rto())) {
+    rtt_.Backoff();
+    TENSIXTY_TRACE(TRACE_INFO, TRACE_WRITER, TRACE_WRITER_TIMEOUT,
+        name_, rtt_.rto() / 1000, 0);
+  }
+}
+
+void Writer::HandleAck(const Ack &outgoing_ack) {
+  if (outgoing_ack.is_start_sequence_ack()) {
+    start_acked_ = true;
     buffer_.RemovePacket(0);
     buffer_.RemovePacket(0x80);
-    buffer_.MarkSequenceStarted();
+    return;
+  }
+  TENSIXTY_TRACE(TRACE_DEBUG, TRACE_WRITER, TRACE_WRITER_GOT_ACK,
+      name_, outgoing_ack.index(), outgoing_ack.error());
+  if (outgoing_ack.error()) {
+    buffer_.MarkResend(outgoing_ack.index());
+  } else if (cumulative_ack_) {
+    SampleRoundTrip(outgoing_ack.index());
+    buffer_.AckThrough(outgoing_ack.index());
+    if (selective_ack_) buffer_.MarkSelective(outgoing_ack);
+    if (credit_ && outgoing_ack.has_credit()) {
+      buffer_.SetCredit(outgoing_ack.index(), outgoing_ack.credit());
+    }
   } else {
-    //printf("No acks.\n");
+    SampleRoundTrip(outgoing_ack.index());
+    buffer_.RemovePacket(outgoing_ack.index());
+  }
+}
+
+bool Writer::AddDatagram(const unsigned char *data, const unsigned int length,
+    const bool latest_wins) {
+  if (!sequence_started_ || length == 0 || length > MAX_DATA_SIZE) return false;
+#if TENSIXTY_MAX_DATAGRAMS == 0
+  (void)data;
+  (void)latest_wins;
+  return false;
+#else
+  Packet *p = nullptr;
+  for (unsigned int i = 0; latest_wins && p == nullptr && i < datagram_count_; ++i) {
+    Packet *queued = &datagrams_[(datagram_head_ + i) % MAX_DATAGRAMS];
+    unsigned char queued_length;
+    if (queued->data(&queued_length)[0] == data[0]) p = queued;
   }
-  // 1e) resend stalled packets after time expiration.
-  unsigned long now = clock_->micros();
-  if (now - last_send_time_ > kResendPeriod) {
-    buffer_.MarkAllResend();
-    last_send_time_ = now;
+  if (p == nullptr) {
+    if (datagram_count_ == MAX_DATAGRAMS) return false;
+    p = &datagrams_[(datagram_head_ + datagram_count_) % MAX_DATAGRAMS];
+    ++datagram_count_;
+    p->Reset();
   }
-  // 1f) new packet, or empty packet with acks
+  p->UseExtendedHeader(extended_header_);
+  p->UseChannel(config_.channel);
+  p->IncludeData(0, data, length);
+  return true;
+#endif
+}
+
+bool Writer::HasDataToSend() {
+  return datagram_count_ > 0 || NextDataPacket() != nullptr;
+}
+
+bool Writer::CanSendData() {
+  const unsigned int size = NextFrameSize();
+  return size > 0 && serial_interface_->available_for_write() >= size;
+}
+
+Packet* Writer::NextDataPacket() {
   Packet *p = buffer_.NextPacket();
+  if (p == nullptr && credit_) p = CreditProbe();
+  return p;
+}
+
+bool Writer::WriteFrame(const bool send_data) {
+  // Datagrams go first. They are sent only once, and latest-wins keeps their
+  // queue short.
+  if (send_data && datagram_count_ > 0) return SendDatagram();
+  // 1f) new packet, or empty packet with acks
+  Packet *p = send_data ? NextDataPacket() : nullptr;
   if (p != nullptr) {
-    printf("%d: Sending new packet from buffer\n", name_);
+    if (credit_ && buffer_.CreditBlocked()) {
+      TENSIXTY_TRACE(TRACE_INFO, TRACE_WRITER, TRACE_WRITER_CREDIT_PROBE, name_, 0, 0);
+    }
     if (p->ack().index() == 0) {
       p->IncludeAck(reader_->PopIncomingAck());
     }
-    printf("%d: Sending next packet: %d\n", name_, p->index_sending());
-    bool sent = SendBytes(*p);
-    last_send_time_ = clock_->micros();
-    return sent;
+    return SendBytes(*p);
   } else if (p == nullptr) {
     //printf("No packets from buffer\n");
+    // Held acks wait for data to ride on, up to a point.
+    if (!reader_->IncomingAckDue(clock_->micros())) return false;
     Ack incoming_ack = reader_->PopIncomingAck();
     if (incoming_ack.index() != 0 || incoming_ack.is_start_sequence_ack()) {
       Packet ack_only_packet;
+      // Channels other than 0 need the extended header even to ack the
+      // start sequence.
+      ack_only_packet.UseExtendedHeader(reader_->ExtendedHeader() || config_.channel != 0);
+      ack_only_packet.UseChannel(config_.channel);
+      ack_only_packet.UseCompactAck(reader_->CompactAck());
       ack_only_packet.IncludeAck(incoming_ack);
-      printf("%d: Sending ack-only packet.\n", name_);
+      TENSIXTY_TRACE(TRACE_DEBUG, TRACE_WRITER, TRACE_WRITER_SEND_ACK_ONLY,
+          name_, incoming_ack.Serialize(), 0);
       return SendBytes(ack_only_packet);
     }
   }
   return false;
 }
 
+bool Writer::SendDatagram() {
+#if TENSIXTY_MAX_DATAGRAMS == 0
+  return false;
+#else
+  Packet *p = &datagrams_[datagram_head_];
+  datagram_head_ = (datagram_head_ + 1) % MAX_DATAGRAMS;
+  --datagram_count_;
+  p->IncludeAck(reader_->PopIncomingAck());
+  unsigned char length;
+  p->data(&length);
+  TENSIXTY_TRACE(TRACE_DEBUG, TRACE_WRITER, TRACE_WRITER_SEND_DATAGRAM, name_, length, 0);
+  return SendBytes(*p);
+#endif
+}
+
 bool Writer::SendBytes(const Packet &p) {
-  unsigned char header[7];
-  unsigned char data[258];
-  unsigned int data_length;
-  p.Serialize(header, data, &data_length);
-  for (int i = 0; i < 7; ++i) {
-    serial_interface_->write(header[i]);
-  }
-  printf("%d: SENDING packet %d with %d bytes acking %d error=%d. Writer initialized=%d \n", name_, p.index_sending(),
-      data_length, (header[2] & 0x7f), (header[2] & 0x80) == 0x80, sequence_started_);
-  for (int i = 0; i < data_length; ++i) {
-    serial_interface_->write(data[i]);
-  }
+  unsigned int length;
+  const unsigned char *frame = p.frame(&length);
+  const size_t written = serial_interface_->write(frame, length);
+  last_frame_size_ = length;
+  TENSIXTY_TRACE(TRACE_DEBUG, TRACE_WRITER, TRACE_WRITER_SEND,
+      name_, p.index_sending(), p.ack().Serialize());
   if (p.index_sending() != 0 || p.start_sequence()) {
-    buffer_.MarkSent(p.index_sending());
+    buffer_.MarkSent(p.index_sending(), clock_->micros());
+    last_data_sent_ = clock_->micros();
   }
-  return true;
+  return written == length;
 }
 
-RxTxPair::RxTxPair(const int name, const Clock &clock, SerialInterface *serial)
-  : reader_(name, serial), writer_(name, clock, serial, &reader_) {}
+bool Writer::NextDeadline(unsigned long *deadline) const {
+  bool found = false;
+  unsigned long sent_time;
+  if (buffer_.OldestSendTime(clock_->micros(), &sent_time)) {
+    *deadline = sent_time + rtt_.rto();
+    found = true;
+  } else if (credit_ && buffer_.CreditBlocked()) {
+    *deadline = last_data_sent_ + rtt_.rto();
+    found = true;
+  }
+  if (batch_length_ > 0) {
+    const unsigned long flush = batch_started_ + config_.batch_delay_micros;
+    if (!found || static_cast<long>(flush - *deadline) < 0) *deadline = flush;
+    found = true;
+  }
+  unsigned long ack_due;
+  if (reader_->IncomingAckDeadline(clock_->micros(), &ack_due)) {
+    if (!found || static_cast<long>(ack_due - *deadline) < 0) *deadline = ack_due;
+    found = true;
+  }
+  return found;
+}
 
-bool RxTxPair::Transmit(const unsigned char *data, const unsigned char length) {
-  return writer_.AddToOutgoingQueue(data, length);
+Packet* Writer::CreditProbe() {
+  if (!buffer_.CreditBlocked()) return nullptr;
+  unsigned long sent_time;
+  if (buffer_.OldestSendTime(clock_->micros(), &sent_time)) return nullptr;
+  if (clock_->micros() - last_data_sent_ < rtt_.rto()) return nullptr;
+  return buffer_.ProbePacket();
+}
+
+void Writer::SampleRoundTrip(const unsigned int index) {
+  unsigned long sent_time;
+  if (buffer_.SentOnce(index, &sent_time)) {
+    rtt_.AddSample(clock_->micros() - sent_time);
+  }
+}
+
+RxTxPair::RxTxPair(const int name, const Clock &clock, SerialInterface *serial,
+    const LinkConfig &config)
+  : clock_(&clock), serial_(serial), reader_(name, serial, config),
+    writer_(name, clock, serial, &reader_, config) {}
+
+bool RxTxPair::Transmit(const unsigned char *data, const unsigned char length,
+    const int supersede_key) {
+  return writer_.AddMessage(data, length, supersede_key);
+}
+
+bool RxTxPair::Transmit(const unsigned char *header, const unsigned char header_length,
+    const unsigned char *data, const unsigned char length, const int supersede_key) {
+  return writer_.AddMessage(header, header_length, data, length, supersede_key);
 }
 
 const unsigned char* RxTxPair::Receive(unsigned char *length) {
+  if (reader_.Batch()) return reader_.PopBatchedMessage(length);
   Packet* p = reader_.PopPacket();
   if (p != nullptr) {
     // Not use after free, because the data is valid until the next reader call.
@@ -454,9 +1196,26 @@ const unsigned char* RxTxPair::Receive(unsigned char *length) {
   }
 }
 
+bool RxTxPair::TransmitDatagram(const unsigned char *data, const unsigned char length,
+    const bool latest_wins) {
+  return writer_.AddDatagram(data, length, latest_wins);
+}
+
+const unsigned char* RxTxPair::ReceiveDatagram(unsigned char *length) {
+  return reader_.PopDatagram(length);
+}
+
 void RxTxPair::Tick() {
   while (reader_.Read());
   writer_.Write();
 }
 
+bool RxTxPair::NextDeadline(unsigned long *deadline) {
+  if (reader_.HasInput() || writer_.CanSendData()) {
+    *deadline = clock_->micros();
+    return true;
+  }
+  return writer_.NextDeadline(deadline);
+}
+
 }  // namespace tensixty
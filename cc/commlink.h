@@ -1,64 +1,294 @@
 #ifndef TENSIXTY_COMMLINK_H_
 #define TENSIXTY_COMMLINK_H_
 
+#include <stdint.h>
 #include "packet.h"
 #include "serial_interface.h"
 #include "clock_interface.h"
+#include "rtt_estimator.h"
 
 namespace tensixty {
 
-const unsigned int BUFFER_SIZE = 4;
+// Most packets in flight in each direction. Every slot holds a full frame in
+// both the reader and the writer, so this stays small on AVR.
+#ifndef TENSIXTY_MAX_WINDOW_SIZE
+#if defined(__AVR__)
+#define TENSIXTY_MAX_WINDOW_SIZE 4
+#else
+#define TENSIXTY_MAX_WINDOW_SIZE 64
+#endif
+#endif
+const unsigned int BUFFER_SIZE = TENSIXTY_MAX_WINDOW_SIZE;
 
+// One bit per buffer slot.
+#if TENSIXTY_MAX_WINDOW_SIZE <= 8
+typedef uint8_t SlotMask;
+#elif TENSIXTY_MAX_WINDOW_SIZE <= 16
+typedef uint16_t SlotMask;
+#elif TENSIXTY_MAX_WINDOW_SIZE <= 32
+typedef uint32_t SlotMask;
+#elif TENSIXTY_MAX_WINDOW_SIZE <= 64
+typedef uint64_t SlotMask;
+#else
+#error "TENSIXTY_MAX_WINDOW_SIZE must be at most 64, the selective ack range."
+#endif
+// Packets in flight unless configured otherwise, and with peers that predate
+// window negotiation.
+const unsigned int DEFAULT_WINDOW_SIZE = 4;
+// Datagrams queued to send, and received but not yet popped. Each outgoing
+// one holds a full frame, and each incoming one a full payload, so AVR builds
+// leave them out unless asked; with 0, TransmitDatagram() fails and datagrams
+// received are dropped.
+#ifndef TENSIXTY_MAX_DATAGRAMS
+#if defined(__AVR__)
+#define TENSIXTY_MAX_DATAGRAMS 0
+#else
+#define TENSIXTY_MAX_DATAGRAMS 4
+#endif
+#endif
+const unsigned int MAX_DATAGRAMS = TENSIXTY_MAX_DATAGRAMS;
+// Bytes of messages batched into one packet, length bytes included. Longer
+// messages go in a packet of their own.
+#ifndef TENSIXTY_MAX_BATCH_SIZE
+#if defined(__AVR__)
+#define TENSIXTY_MAX_BATCH_SIZE 64
+#else
+#define TENSIXTY_MAX_BATCH_SIZE 255
+#endif
+#endif
+const unsigned int MAX_BATCH_SIZE = TENSIXTY_MAX_BATCH_SIZE;
+// Acks the reader holds for the writer, in each direction. The reader keeps
+// parsing until one of these queues is full, so several frames can arrive
+// between writes.
+#ifndef TENSIXTY_ACK_QUEUE_SIZE
+#if defined(__AVR__)
+#define TENSIXTY_ACK_QUEUE_SIZE 4
+#else
+#define TENSIXTY_ACK_QUEUE_SIZE 8
+#endif
+#endif
+const unsigned int ACK_QUEUE_SIZE = TENSIXTY_ACK_QUEUE_SIZE;
+// Messages queued without a supersede key are always delivered. Keys run
+// from 0 to 255.
+const int NO_SUPERSEDE_KEY = -1;
+// Bytes pulled off the serial link per parse pass.
+const unsigned int READ_CHUNK_SIZE = 64;
+
+// Capability bits offered in the start sequence.
+const unsigned char CAPABILITY_EXTENDED_HEADER = 0x01;
+const unsigned char CAPABILITY_SELECTIVE_ACK = 0x02;
+const unsigned char CAPABILITY_CUMULATIVE_ACK = 0x04;
+const unsigned char CAPABILITY_COMPACT_ACK = 0x08;
+const unsigned char CAPABILITY_CREDIT = 0x10;
+const unsigned char CAPABILITY_BATCH = 0x20;
+
+// Settings for one end of a link. Each end sends its own in the start
+// sequence, and anything optional is used only if both ends offer it.
+struct LinkConfig {
+  // Packets in flight in each direction. Clamped to BUFFER_SIZE, and to a
+  // quarter of the index space of the header in use: 31 with basic headers.
+  unsigned int window_size = DEFAULT_WINDOW_SIZE;
+  // Offer the extended header, which carries 15-bit indices.
+  bool extended_header = false;
+  // Offer selective acks, so only lost packets are resent. Needs the
+  // extended header, and implies cumulative acks.
+  bool selective_ack = false;
+  // Offer cumulative acks: an ack covers every packet up to its index, so the
+  // reader may hold it back and send one for several packets.
+  bool cumulative_ack = false;
+  // With cumulative acks, how long the reader may hold an ack hoping it can
+  // ride on outgoing data, and how many packets it may leave unacked
+  // meanwhile. These stay local.
+  unsigned long ack_delay_micros = 0;
+  unsigned int ack_every_packets = 2;
+  // Offer compact ack-only frames, which leave out the index, length and
+  // payload checksum of an empty packet.
+  bool compact_ack = false;
+  // Logical channel served by this end, when several share one link through
+  // a ChannelMux. Channels other than 0 always use the extended header.
+  unsigned int channel = 0;
+  // Offer receive window credit: acks report packets as they arrive, with the
+  // space left for more, and the writer never sends past it. Needs the
+  // extended header, and implies cumulative acks.
+  bool credit = false;
+  // Offer batching: every packet carries one or more messages, each behind a
+  // length byte, so that messages sent close together share a frame and an
+  // ack. A batch goes out once batch_delay_micros have passed since its
+  // first message; with no delay, that is the next tick. Messages are then
+  // limited to 254 bytes. The delay stays local.
+  bool batch = false;
+  unsigned long batch_delay_micros = 0;
+  // Bytes Write() may send in one call. It sends one frame, then starts more
+  // while data is waiting, the serial port has room for the next frame
+  // without blocking, and fewer than this many bytes have gone out. With 0,
+  // every call sends one frame. Stays local.
+  unsigned int write_budget_bytes = 0;
+  // Retransmit timeout bounds, in microseconds. These stay local. The timeout
+  // starts at initial_rto_micros and then follows the measured round trips.
+  unsigned long initial_rto_micros = 100000;
+  unsigned long min_rto_micros = 2000;
+  unsigned long max_rto_micros = 2000000;
+};
+
+// Acks waiting for the writer, oldest first.
+class AckQueue {
+ public:
+  AckQueue() : head_(0), count_(0) {}
+  // Adds an ack, unless the same plain ack is queued already. Acks carrying
+  // selective bits or credit are always added, since each one reports its
+  // own state. With merge, an ok ack replaces an ok one at the back instead,
+  // unless either is for index 0.
+  // Returns false if the queue is full.
+  bool Push(const Ack &ack, bool merge = false);
+  // Pops the oldest ack, or returns an empty one.
+  Ack Pop();
+  bool empty() const { return count_ == 0; }
+  bool full() const { return count_ == ACK_QUEUE_SIZE; }
+  void Clear() { count_ = 0; }
+ private:
+  Ack acks_[ACK_QUEUE_SIZE];
+  unsigned int head_;
+  unsigned int count_;
+};
+
+// Incoming packets. Each packet is parsed in a free slot, then moved into a
+// ring ordered by index, starting with the next one to pop.
 class PacketRingBuffer {
  public:
   PacketRingBuffer();
+  // Sets how many packets may be held and the largest index in use. A spare
+  // slot lets packets still be parsed, and their acks read, with the window
+  // full. Only call while the buffer is empty.
+  void Configure(unsigned int window_size, unsigned int max_index, bool spare_slot = false);
+  unsigned int window_size() const { return window_size_; }
   // Allocates a packet from the buffer.
   Packet* AllocatePacket();
   // Returns true if there is no space left.
   bool full() const;
   // Pops the next packet, in order.
   Packet* PopPacket();
+  // Returns the next packet without popping it.
+  Packet* PeekPacket();
   // Deletes all entries in the buffer.
   void Clear();
   // Returns true if the given index is valid as an incoming packet index.
-  bool InRange(unsigned char index_sending);
+  bool InRange(unsigned int index_sending) const;
+  // Packets held in order after the last one popped, with none missing
+  // between them.
+  unsigned int ReceivedInOrder();
+  // True if a packet before index is still missing.
+  bool MissingBefore(unsigned int index);
+  // An ack for the last packet popped.
+  Ack CumulativeAck() const;
+  // A cumulative ack for the last packet popped, marking every packet held
+  // after it as received.
+  Ack SelectiveAck();
+  // A cumulative ack for the packets held in order, with the credit left in
+  // the window after them, and optionally the selective acks past a gap.
+  Ack ReceivedAck(bool selective);
  private:
-  // Clears any packets left in an erroneous state as well as any packets too far
-  // from the last_index_number_.
+  // Moves packets that finished parsing into the ring, and frees any that
+  // failed, are out of range or duplicate a packet already held.
   void Cleanup();
+  void Free(unsigned int slot);
 
   Packet buffer_[BUFFER_SIZE];
-  bool live_indices_[BUFFER_SIZE];
-  unsigned char last_index_number_;
+  // Slots in use, and those not yet moved into the ring.
+  SlotMask allocated_;
+  SlotMask unplaced_;
+  unsigned int allocated_count_;
+  // Ring position n holds the slot of the packet at index distance n from
+  // head_, if its bit in ring_live_ is set.
+  unsigned char ring_[BUFFER_SIZE];
+  SlotMask ring_live_;
+  unsigned int head_;
+  unsigned int window_size_;
+  bool spare_slot_;
+  unsigned int max_index_;
+  unsigned int last_index_number_;
 };
 
+// Outgoing packets, held in a ring in the order they were allocated. Packets
+// must be given consecutive indices in that order, as the writer does, so a
+// packet's slot follows from its distance to the oldest one held.
 class OutgoingPacketBuffer {
  public:
   explicit OutgoingPacketBuffer(int name);
-  // Allocates a packet from the buffer.
-  Packet* AllocatePacket();
+  // Sets how many packets may be held and the largest index in use. Only
+  // call while the buffer is empty.
+  void Configure(unsigned int window_size, unsigned int max_index);
+  // Allocates a packet from the buffer. Until it is first sent, a packet
+  // allocated with a supersede key can be found again to be replaced.
+  Packet* AllocatePacket(int supersede_key = NO_SUPERSEDE_KEY);
+  // The packet allocated with the supersede key that has not been sent yet,
+  // or null.
+  Packet* UnsentPacket(int supersede_key);
 
   // Returns packets that need to be resent, if any.
   Packet* PeekResendPacket();
   // Finds the packet with the given index. If there is none indicated, returns
   // the next packet to be popped. Does not remove the packet, as pop() does.
-  Packet* PeekPacket(unsigned char index);
+  Packet* PeekPacket(unsigned int index);
   Packet* NextPacket();
-  void RemovePacket(unsigned char index);
-  void MarkSent(unsigned char index);
-  void MarkResend(unsigned char index);
-  void MarkAllResend();
+  // With credit: the oldest packet waiting, even past the credit limit.
+  Packet* ProbePacket();
+  void RemovePacket(unsigned int index);
+  // With selective acks: removes every packet up to and including index.
+  void AckThrough(unsigned int index);
+  // With selective acks: stops resending the packets the ack reports, and
+  // resends the gaps before them the first time they show up.
+  void MarkSelective(const Ack &ack);
+  // Records that the packet went out at time now.
+  void MarkSent(unsigned int index, unsigned long now);
+  // If the packet was sent exactly once, sets sent_time and returns true. Its
+  // ack then gives a round trip time.
+  bool SentOnce(unsigned int index, unsigned long *sent_time) const;
+  // Times a packet has been sent, or 0 if it isn't held.
+  unsigned int SendCount(unsigned int index) const;
+  void MarkResend(unsigned int index);
+  // Returns true if anything was marked.
+  bool MarkAllResend();
+  // Marks for resend every packet sent at least rto ago and not acked since.
+  // Returns true if anything was marked.
+  bool MarkExpired(unsigned long now, unsigned long rto);
+  // Sets sent_time to the send time of the packet waiting longest for its
+  // ack. Returns false if none are waiting.
+  bool OldestSendTime(unsigned long now, unsigned long *sent_time) const;
+  // Drops anything left from before the sequence started.
   void MarkSequenceStarted();
+  // With credit: stops NextPacket() past index ack + credit.
+  void SetCredit(unsigned int ack, unsigned int credit);
+  // True if packets are waiting, but all of them are past the credit limit.
+  bool CreditBlocked() const;
  private:
-  // Returns true if packet_index precedes sent_index.
-  bool PrecedesIndex(unsigned char packet_index, unsigned char sent_index) const;
-  void UpdateNextIndex();
+  // Slot of the packet with the given index, or -1 if it isn't held.
+  int SlotOf(unsigned int index) const;
+  // Frees the slots, then moves head_ up to the oldest packet still held.
+  void Release(SlotMask slots);
+  // Sent and waiting on an ack.
+  SlotMask Outstanding() const;
+
   Packet buffer_[BUFFER_SIZE];
-  bool live_indices_[BUFFER_SIZE];
-  bool pending_indices_[BUFFER_SIZE];
-  // Makes it easier to handle indices wrapping around.
-  unsigned char earliest_sent_index_;
-  bool sequence_started_;
+  SlotMask live_;
+  SlotMask pending_;
+  // Selectively acked; kept until the cumulative ack passes them.
+  SlotMask selective_acked_;
+  // Per packet retransmit timers.
+  unsigned long sent_time_[BUFFER_SIZE];
+  // Saturates at 255.
+  unsigned char send_count_[BUFFER_SIZE];
+  // Allocated with a supersede key and not sent yet, and their keys.
+  SlotMask keyed_;
+  unsigned char supersede_key_[BUFFER_SIZE];
+  // Oldest slot held, and how many slots from there on are in use,
+  // including any freed out of order.
+  unsigned int head_;
+  unsigned int used_;
+  unsigned int window_size_;
+  unsigned int max_index_;
+  // The last index the other end has room for, if it sends credit.
+  bool credit_limited_;
+  unsigned int credit_limit_;
   int name_;
 };
 
@@ -67,63 +297,264 @@ class AckProvider {
   // Returns incoming and outgoing acks.
   virtual Ack PopIncomingAck() = 0;
   virtual Ack PopOutgoingAck() = 0;
+  // What was agreed with the other end in its start sequence. The writer does
+  // not start its own sequence until the other end's settings are known.
+  virtual bool PeerSettingsKnown() const { return true; }
+  virtual bool ExtendedHeader() const { return false; }
+  virtual bool SelectiveAck() const { return false; }
+  virtual bool CumulativeAck() const { return false; }
+  virtual bool CompactAck() const { return false; }
+  virtual bool Credit() const { return false; }
+  virtual bool Batch() const { return false; }
+  virtual unsigned int PeerWindowSize() const { return DEFAULT_WINDOW_SIZE; }
+  // True if an incoming ack should go out now, even without data to carry
+  // it. Acks may be held back for a while first; the first call after one is
+  // held starts the wait.
+  virtual bool IncomingAckDue(unsigned long /*now*/) { return true; }
+  // When a held incoming ack becomes due, or now if one is due already.
+  // Returns false if none is waiting.
+  virtual bool IncomingAckDeadline(unsigned long /*now*/,
+      unsigned long * /*deadline*/) const {
+    return false;
+  }
 };
 
 class Reader : public AckProvider {
  public:
-  Reader(int name, SerialInterface *arduino);
+  Reader(int name, SerialInterface *arduino, const LinkConfig &config = LinkConfig());
   // Returns true if anything was read and the reader can keep reading.
-  // Pending acks, lack of data, or a full read buffer will cause this to return false.
+  // Full ack queues, lack of data, or a full read buffer will cause this to
+  // return false.
   bool Read();
+  // Same as Read(), but parses bytes the caller already received. Sets
+  // consumed to the number of bytes used; the rest must be offered again.
+  bool Read(const unsigned char *buf, size_t length, size_t *consumed);
   // Returns a finished packet. Null if there are no packets.
   Packet* PopPacket();
+  // Returns the packet PopPacket() would, without popping it.
+  Packet* PeekPacket();
+  // With batching, returns the next message in the packet PopPacket() would
+  // return, and pops the packet with its last message. Null if there are no
+  // packets, or the next message is malformed.
+  const unsigned char* PopBatchedMessage(unsigned char *length);
+  // Returns the oldest datagram received, or null if there are none. The data
+  // stays valid until the next read. When datagrams arrive faster than they
+  // are popped, the oldest are dropped.
+  const unsigned char* PopDatagram(unsigned char *length);
   // Returns incoming and outgoing acks.
   Ack PopIncomingAck() override;
   Ack PopOutgoingAck() override;
+  bool PeerSettingsKnown() const override { return sequence_started_; }
+  bool ExtendedHeader() const override { return extended_header_; }
+  bool SelectiveAck() const override { return selective_ack_; }
+  bool CumulativeAck() const override { return cumulative_ack_; }
+  bool CompactAck() const override { return compact_ack_; }
+  bool Credit() const override { return credit_; }
+  bool Batch() const override { return batch_; }
+  unsigned int PeerWindowSize() const override { return peer_window_size_; }
+  bool IncomingAckDue(unsigned long now) override;
+  bool IncomingAckDeadline(unsigned long now, unsigned long *deadline) const override;
+  // True if bytes are waiting to be parsed, here or in the serial port.
+  bool HasInput();
   bool Initialized() const { return sequence_started_; };
 
  private:
+  // Handles a packet that finished parsing, successfully or not.
+  bool HandleParseStatus(ParseStatus status);
+  // Takes the other end's settings from its start sequence packet.
+  void AcceptPeerSettings(const Packet &start_packet);
+  void AcceptDatagram(const Packet &p);
+
   SerialInterface *serial_;
+  // Bytes read from serial_ but not yet parsed.
+  unsigned char read_chunk_[READ_CHUNK_SIZE];
+  unsigned int read_chunk_start_;
+  unsigned int read_chunk_end_;
   // Packet under construction. Points to an object stored in buffer_.
   Packet *current_packet_;
   PacketRingBuffer buffer_;
-  Ack incoming_ack_;
-  Ack outgoing_ack_;
+  // Acks to send, and acks received for the writer.
+  AckQueue incoming_acks_;
+  AckQueue outgoing_acks_;
   bool sequence_started_;
+  const LinkConfig config_;
+  bool extended_header_;
+  bool selective_ack_;
+  bool cumulative_ack_;
+  bool compact_ack_;
+  bool credit_;
+  bool batch_;
+  // With credit, the last index the other end was told it may send.
+  unsigned int credit_limit_;
+  // Something arrived that the next cumulative ack should report.
+  bool cumulative_ack_pending_;
+  // Send it without waiting for data or more packets.
+  bool cumulative_ack_urgent_;
+  // Packets popped since the last cumulative ack, and when the wait to send
+  // one started.
+  unsigned int unacked_packets_;
+  bool ack_delay_started_;
+  unsigned long ack_delay_start_;
+  unsigned int peer_window_size_;
+  // With batching, the next message's offset in the packet PeekPacket()
+  // returns. Cleared with the buffer.
+  unsigned int batch_offset_;
+  // Ring of datagrams received.
+#if TENSIXTY_MAX_DATAGRAMS > 0
+  unsigned char datagrams_[MAX_DATAGRAMS][MAX_DATA_SIZE];
+  unsigned char datagram_lengths_[MAX_DATAGRAMS];
+#endif
+  unsigned int datagram_head_;
+  unsigned int datagram_count_;
   const int name_;
 };
 
 class Writer {
  public:
-  Writer(int name, const Clock &clock, SerialInterface *arduino, AckProvider *reader);
-  // Returns false if we can't accept the packet.
-  bool AddToOutgoingQueue(const unsigned char *data, const unsigned int length);
+  Writer(int name, const Clock &clock, SerialInterface *arduino, AckProvider *reader,
+      const LinkConfig &config = LinkConfig());
+  // Returns false if we can't accept the packet. A message with a supersede
+  // key replaces a queued one with the same key that has not been sent yet,
+  // keeping its place and index; the older one is never delivered.
+  bool AddToOutgoingQueue(const unsigned char *data, const unsigned int length,
+      int supersede_key = NO_SUPERSEDE_KEY);
+  // Same, for a message sent as a header followed by data, without joining
+  // them first.
+  bool AddToOutgoingQueue(const unsigned char *header, unsigned int header_length,
+      const unsigned char *data, unsigned int length, int supersede_key = NO_SUPERSEDE_KEY);
+  // Like AddToOutgoingQueue(), but batches the message with others if both
+  // ends agreed to. Messages with a supersede key go in a packet of their own.
+  bool AddMessage(const unsigned char *data, unsigned int length,
+      int supersede_key = NO_SUPERSEDE_KEY);
+  bool AddMessage(const unsigned char *header, unsigned int header_length,
+      const unsigned char *data, unsigned int length, int supersede_key = NO_SUPERSEDE_KEY);
+  // Queues the batch so far as one packet. Returns false if the queue is full.
+  bool FlushBatch();
+  // Queues a datagram: sent once, outside the sequence, with no ack and no
+  // resend. With latest_wins it replaces a queued datagram of the same type,
+  // its first byte, instead. Returns false until the link is up, or if the
+  // queue is full.
+  bool AddDatagram(const unsigned char *data, unsigned int length, bool latest_wins);
+  // Sends a frame, or a burst of them; see LinkConfig::write_budget_bytes.
+  // Returns true if bytes are sent.
   bool Write();
+  // Write() in two steps, for a scheduler sharing the link between channels.
+  // HandleAcks() takes in acks, marks timeouts and queues a batch that is
+  // due. WriteFrame() then sends
+  // the next datagram or data packet if send_data is set and there is one, or
+  // else an ack-only frame if an ack is due. Returns true if bytes are sent.
+  void HandleAcks();
+  bool HasDataToSend();
+  // True if data is waiting and the serial port has room for its frame.
+  bool CanSendData();
+  bool WriteFrame(bool send_data);
   bool Initialized() const { return sequence_started_; };
+  unsigned int channel() const { return config_.channel; }
+  // Round trip estimate and current retransmit timeout.
+  const RttEstimator& rtt_estimator() const { return rtt_; }
+  // When the earliest unacked packet times out, a writer out of credit
+  // probes for more, a batch is due, or a held ack must go, in clock micros.
+  // Returns false if nothing is waiting. Compare against the clock with
+  // subtraction, since it wraps.
+  bool NextDeadline(unsigned long *deadline) const;
  private:
   const Clock* clock_;
-  unsigned char NextIndex();
+  unsigned int NextIndex();
+  // Starts sending data, with the settings agreed with the other end.
+  void StartSequence();
   // Returns true if bytes are sent.
   bool SendBytes(const Packet &p);
+  // Acts on one ack from the other end.
+  void HandleAck(const Ack &outgoing_ack);
+  // Times the round trip of the packet acked, unless it was resent.
+  void SampleRoundTrip(unsigned int index);
+  // The next data packet to send, if any: new, resent or probing for credit.
+  Packet* NextDataPacket();
+  bool SendDatagram();
+  // Upper bound on the size of the next data frame, with any ack it picks up.
+  unsigned int NextFrameSize();
+  // Queues a message alone, behind its length byte.
+  bool AddRecord(const unsigned char *header, unsigned int header_length,
+      const unsigned char *data, unsigned int length, int supersede_key);
+  // Queues a packet whose payload is gathered from pieces, in order.
+  bool QueuePieces(const unsigned char *const *pieces, const unsigned int *lengths,
+      unsigned int count, int supersede_key);
+  // With credit: a packet to send past the limit, in case the ack that
+  // raised it was lost. Sent once nothing else has gone out for a timeout.
+  Packet* CreditProbe();
 
   SerialInterface *serial_interface_;
   OutgoingPacketBuffer buffer_;
   AckProvider *reader_;
-  unsigned char current_index_;
-  unsigned long last_send_time_;
+  const LinkConfig config_;
+  unsigned int current_index_;
+  unsigned int max_index_;
+  bool extended_header_;
+  bool selective_ack_;
+  bool cumulative_ack_;
+  bool credit_;
+  bool batch_;
+  // Messages batched for the next packet, each behind its length byte, and
+  // when the first was added.
+  unsigned char batch_buffer_[MAX_BATCH_SIZE];
+  unsigned int batch_length_;
+  unsigned long batch_started_;
+  // Bytes in the last frame sent.
+  unsigned int last_frame_size_;
+  // When a data packet last went out.
+  unsigned long last_data_sent_;
+  RttEstimator rtt_;
+  // The other end acked our start sequence.
+  bool start_acked_;
   bool sequence_started_;
+  // Ring of datagrams to send, as finished frames.
+#if TENSIXTY_MAX_DATAGRAMS > 0
+  Packet datagrams_[MAX_DATAGRAMS];
+#endif
+  unsigned int datagram_head_;
+  unsigned int datagram_count_;
   const int name_;
 };
 
 class RxTxPair {
  public:
-  RxTxPair(int name, const Clock &clock, SerialInterface *serial);
-  bool Transmit(const unsigned char *data, const unsigned char length);
+  RxTxPair(int name, const Clock &clock, SerialInterface *serial,
+      const LinkConfig &config = LinkConfig());
+  // With a supersede key, such as the message type, replaces an unsent
+  // message queued with the same key. See Writer::AddToOutgoingQueue().
+  bool Transmit(const unsigned char *data, const unsigned char length,
+      int supersede_key = NO_SUPERSEDE_KEY);
+  // Sends header then data as one message, read from both in place.
+  bool Transmit(const unsigned char *header, unsigned char header_length,
+      const unsigned char *data, unsigned char length, int supersede_key = NO_SUPERSEDE_KEY);
   const unsigned char* Receive(unsigned char *length);
+  // With batching, queues the messages batched so far without waiting for
+  // their delay. Returns false if the queue is full.
+  bool Flush() { return writer_.FlushBatch(); }
+  // Unreliable datagrams, for values the next one supersedes, such as
+  // reports: checksummed, but never acked or resent, and not ordered against
+  // Transmit() data. With latest_wins, a datagram replaces a queued one whose
+  // first byte matches. Received datagrams stay valid until the next Tick().
+  bool TransmitDatagram(const unsigned char *data, unsigned char length,
+      bool latest_wins = false);
+  const unsigned char* ReceiveDatagram(unsigned char *length);
   void Tick();
   bool Initialized() const { return reader_.Initialized() && writer_.Initialized(); }
+  const RttEstimator& rtt_estimator() const { return writer_.rtt_estimator(); }
+  // For hosts that wait between ticks: when Tick() next has work, in clock
+  // micros. That is now if input is waiting, or data with room to write it,
+  // or else the writer's next deadline. Returns false if only new input or new messages
+  // would give it work; wait on fd() for the first.
+  bool NextDeadline(unsigned long *deadline);
+  int fd() { return serial_->fd(); }
+  unsigned int channel() const { return writer_.channel(); }
 
  private:
+  // Ticks the reader and writer itself when channels share a link.
+  friend class ChannelMux;
+
+  const Clock *clock_;
+  SerialInterface *serial_;
   Reader reader_;
   Writer writer_;
 };
@@ -0,0 +1,126 @@
+#include "fragmenter.h"
+#include <string.h>
+
+namespace tensixty {
+
+Fragmenter::Fragmenter(RxTxPair *pair)
+  : pair_(pair), outgoing_count_(0), next_outgoing_(0), next_id_(0),
+    incoming_count_(0), dropped_(0) {}
+
+bool Fragmenter::Transmit(const unsigned char *data, const unsigned int length) {
+  if (length == 0 || length > MAX_FRAGMENTED_MESSAGE_SIZE) return false;
+  if (outgoing_count_ == MAX_FRAGMENTED_MESSAGES) return false;
+  Outgoing &m = outgoing_[outgoing_count_++];
+  m.data = data;
+  m.length = length;
+  m.sent = 0;
+  m.id = next_id_++;
+  return true;
+}
+
+bool Fragmenter::Sending(const unsigned char *data) const {
+  for (unsigned int i = 0; i < outgoing_count_; ++i) {
+    if (outgoing_[i].data == data) return true;
+  }
+  return false;
+}
+
+bool Fragmenter::AddBuffer(unsigned char *buffer, const unsigned int size) {
+  if (incoming_count_ == MAX_FRAGMENTED_MESSAGES) return false;
+  Incoming &m = incoming_[incoming_count_++];
+  m.buffer = buffer;
+  m.size = size;
+  m.in_use = false;
+  return true;
+}
+
+unsigned char* Fragmenter::Receive(unsigned int *length) {
+  for (unsigned int i = 0; i < incoming_count_; ++i) {
+    Incoming &m = incoming_[i];
+    if (!m.in_use || m.received < m.length) continue;
+    unsigned char *buffer = m.buffer;
+    *length = m.length;
+    m = incoming_[--incoming_count_];
+    return buffer;
+  }
+  *length = 0;
+  return nullptr;
+}
+
+void Fragmenter::Update() {
+  // Outgoing messages take turns, a fragment each.
+  while (outgoing_count_ > 0) {
+    if (next_outgoing_ >= outgoing_count_) next_outgoing_ = 0;
+    if (!SendFragment(next_outgoing_)) break;
+    if (outgoing_[next_outgoing_].sent < outgoing_[next_outgoing_].length) {
+      ++next_outgoing_;
+      continue;
+    }
+    // Done; the rest keep their order.
+    --outgoing_count_;
+    for (unsigned int i = next_outgoing_; i < outgoing_count_; ++i) {
+      outgoing_[i] = outgoing_[i + 1];
+    }
+  }
+  unsigned char length;
+  const unsigned char *data;
+  while ((data = pair_->Receive(&length)) != nullptr) {
+    AcceptFragment(data, length);
+  }
+}
+
+bool Fragmenter::SendFragment(const unsigned int i) {
+  Outgoing &m = outgoing_[i];
+  const unsigned int remaining = m.length - m.sent;
+  const unsigned int size = remaining < MAX_FRAGMENT_DATA_SIZE ? remaining : MAX_FRAGMENT_DATA_SIZE;
+  const unsigned char header[FRAGMENT_HEADER_SIZE] = {
+    m.id,
+    static_cast<unsigned char>(m.length >> 8),
+    static_cast<unsigned char>(m.length & 0xff),
+    static_cast<unsigned char>(m.sent >> 8),
+    static_cast<unsigned char>(m.sent & 0xff),
+  };
+  // The data goes into the packet straight from the caller's memory.
+  if (!pair_->Transmit(header, FRAGMENT_HEADER_SIZE, m.data + m.sent, size)) return false;
+  m.sent += size;
+  return true;
+}
+
+void Fragmenter::AcceptFragment(const unsigned char *fragment, const unsigned int length) {
+  if (length < FRAGMENT_HEADER_SIZE) return;
+  const unsigned char id = fragment[0];
+  const unsigned int total = (static_cast<unsigned int>(fragment[1]) << 8) | fragment[2];
+  const unsigned int offset = (static_cast<unsigned int>(fragment[3]) << 8) | fragment[4];
+  const unsigned int size = length - FRAGMENT_HEADER_SIZE;
+  Incoming *m = nullptr;
+  for (unsigned int i = 0; i < incoming_count_ && m == nullptr; ++i) {
+    Incoming &candidate = incoming_[i];
+    if (candidate.in_use && candidate.id == id && candidate.received < candidate.length) {
+      m = &candidate;
+    }
+  }
+  if (m == nullptr) {
+    // The rest of a message already dropped.
+    if (offset != 0) return;
+    // The smallest free buffer that fits.
+    for (unsigned int i = 0; i < incoming_count_; ++i) {
+      Incoming &candidate = incoming_[i];
+      if (candidate.in_use || candidate.size < total) continue;
+      if (m == nullptr || candidate.size < m->size) m = &candidate;
+    }
+    if (m == nullptr) {
+      ++dropped_;
+      return;
+    }
+    m->in_use = true;
+    m->id = id;
+    m->length = total;
+    m->received = 0;
+  }
+  // Both come off the wire; offset + size could wrap with 16-bit ints.
+  if (offset > m->length || size > m->length - offset) return;
+  memcpy(m->buffer + offset, fragment + FRAGMENT_HEADER_SIZE, size);
+  m->received += size;
+}
+
+}  // namespace tensixty
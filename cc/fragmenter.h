@@ -0,0 +1,88 @@
+#ifndef TENSIXTY_FRAGMENTER_H_
+#define TENSIXTY_FRAGMENTER_H_
+
+#include "commlink.h"
+
+namespace tensixty {
+
+// Messages being sent, and being reassembled, at once.
+#ifndef TENSIXTY_MAX_FRAGMENTED_MESSAGES
+#if defined(__AVR__)
+#define TENSIXTY_MAX_FRAGMENTED_MESSAGES 2
+#else
+#define TENSIXTY_MAX_FRAGMENTED_MESSAGES 4
+#endif
+#endif
+const unsigned int MAX_FRAGMENTED_MESSAGES = TENSIXTY_MAX_FRAGMENTED_MESSAGES;
+
+// Each fragment starts with the message id, then its total length and the
+// fragment's offset, both two bytes, high byte first. Fragments leave room
+// for the length byte of a batched link.
+const unsigned int FRAGMENT_HEADER_SIZE = 5;
+const unsigned int MAX_FRAGMENT_DATA_SIZE = MAX_DATA_SIZE - 1 - FRAGMENT_HEADER_SIZE;
+const unsigned int MAX_FRAGMENTED_MESSAGE_SIZE = 0xffff;
+
+// Carries messages of up to 64k over an RxTxPair, split into packets. Both
+// ends must use a Fragmenter, since every packet carries a fragment header.
+//
+// Outgoing messages are sent from the caller's memory, taking turns a
+// fragment at a time, so a short message is not held up behind a long one.
+// Incoming messages are reassembled straight into buffers the caller lends,
+// so the other end must not have more messages in flight than there are
+// free buffers; fragments of a message with no buffer are dropped.
+//
+// Tick the pair (or its ChannelMux) as usual, and call Update() after it.
+class Fragmenter {
+ public:
+  explicit Fragmenter(RxTxPair *pair);
+  // Queues a message. The data must stay valid while Sending() it. Returns
+  // false if it is too long, or MAX_FRAGMENTED_MESSAGES are being sent.
+  bool Transmit(const unsigned char *data, unsigned int length);
+  bool Sending(const unsigned char *data) const;
+  // Lends a buffer for one incoming message of up to size bytes. Returns
+  // false if MAX_FRAGMENTED_MESSAGES buffers are lent already.
+  bool AddBuffer(unsigned char *buffer, unsigned int size);
+  // Returns a complete message, in one of the lent buffers, or null. The
+  // buffer is the caller's again, until lent anew.
+  unsigned char* Receive(unsigned int *length);
+  // Sends fragments while the pair takes them, and reassembles those that
+  // arrived.
+  void Update();
+  // Messages dropped for lack of a buffer.
+  unsigned int dropped() const { return dropped_; }
+
+ private:
+  struct Outgoing {
+    const unsigned char *data;
+    unsigned int length;
+    unsigned int sent;
+    unsigned char id;
+  };
+  // A lent buffer, and the message reassembled in it, if any.
+  struct Incoming {
+    unsigned char *buffer;
+    unsigned int size;
+    bool in_use;
+    unsigned char id;
+    unsigned int length;
+    unsigned int received;
+  };
+
+  // Sends the next fragment of outgoing_[i]. Returns false if the pair is full.
+  bool SendFragment(unsigned int i);
+  void AcceptFragment(const unsigned char *fragment, unsigned int length);
+
+  RxTxPair *pair_;
+  Outgoing outgoing_[MAX_FRAGMENTED_MESSAGES];
+  unsigned int outgoing_count_;
+  // Next message to send a fragment of.
+  unsigned int next_outgoing_;
+  unsigned char next_id_;
+  Incoming incoming_[MAX_FRAGMENTED_MESSAGES];
+  unsigned int incoming_count_;
+  unsigned int dropped_;
+};
+
+}  // namespace tensixty
+
+#endif  // TENSIXTY_FRAGMENTER_H_
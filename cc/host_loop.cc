@@ -0,0 +1,38 @@
+#include "host_loop.h"
+#include <poll.h>
+#include <sys/stat.h>
+
+namespace tensixty {
+namespace {
+
+// Regular files always poll as readable, so waiting on them would spin.
+bool Pollable(const int fd) {
+  struct stat file_stat;
+  return fd >= 0 && fstat(fd, &file_stat) == 0 && !S_ISREG(file_stat.st_mode);
+}
+
+}  // namespace
+
+void WaitForWork(RxTxPair *pair, const Clock &clock, const int extra_fd,
+    const unsigned long max_wait_micros) {
+  unsigned long wait = max_wait_micros;
+  unsigned long deadline;
+  if (pair->NextDeadline(&deadline)) {
+    const long remaining = static_cast<long>(deadline - clock.micros());
+    if (remaining <= 0) return;
+    if (static_cast<unsigned long>(remaining) < wait) wait = remaining;
+  }
+  struct pollfd fds[2];
+  nfds_t count = 0;
+  const int wanted[2] = {pair->fd(), extra_fd};
+  for (int i = 0; i < 2; ++i) {
+    if (!Pollable(wanted[i])) continue;
+    fds[count].fd = wanted[i];
+    fds[count].events = POLLIN;
+    ++count;
+  }
+  // Rounds up, so the deadline has passed on waking.
+  poll(fds, count, (wait + 999) / 1000);
+}
+
+}  // namespace tensixty
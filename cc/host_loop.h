@@ -0,0 +1,18 @@
+#ifndef TENSIXTY_HOST_LOOP_H_
+#define TENSIXTY_HOST_LOOP_H_
+
+#include "commlink.h"
+
+namespace tensixty {
+
+// For host programs that tick a pair in a loop: blocks until the pair has
+// work, its fd() or extra_fd (if not -1) turns readable, or max_wait_micros
+// pass, whichever is first. Regular files can't be waited on, so new bytes
+// in them are only noticed when the wait ends; keep max_wait_micros short
+// for them. Not for the Arduino build.
+void WaitForWork(RxTxPair *pair, const Clock &clock, int extra_fd,
+    unsigned long max_wait_micros);
+
+}  // namespace tensixty
+
+#endif  // TENSIXTY_HOST_LOOP_H_
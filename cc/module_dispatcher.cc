@@ -1,12 +1,12 @@
-#include <stdio.h>
 #include "module_dispatcher.h"
+#include "trace.h"
 
 namespace markbot {
 
 Message::Message(unsigned char length, const unsigned char *data)
   : length_(length), message_type_(data == nullptr ? 0 : data[0]),
   data_(data) {
-    printf("Message of length %d and type %d\n", length_, message_type_);
+    TENSIXTY_TRACE(TRACE_DEBUG, TRACE_DISPATCH, ::tensixty::TRACE_MESSAGE, message_type_, length_, 0);
   }
 
 Message::Message(unsigned char message_type, unsigned char length,
@@ -1,4 +1,5 @@
 #include "motor.h"
+#include "trace.h"
 #include <math.h>
 #if __x86_64__
 #include <algorithm>
@@ -15,6 +16,21 @@ using std::abs;
 
 namespace markbot {
 
+#if TENSIXTY_TRACE_LEVEL > 0
+namespace {
+
+// Steps per tick * 10000, clamped to a trace argument. Casting a float that
+// doesn't fit is undefined, and this runs in the ISR.
+int16_t TraceSpeed(const float speed) {
+  const float scaled = speed * 10000;
+  if (!(scaled > -32768)) return -32768;
+  if (scaled >= 32767) return 32767;
+  return static_cast<int16_t>(scaled);
+}
+
+}  // namespace
+#endif
+
 Motor::Motor() {
   pulse_state_ = false;
   current_absolute_steps_ = 0;
@@ -124,7 +140,8 @@ void Motor::FastTick() {
     return;
   }
   step_speed_ += acceleration_;
-  printf("Update step speed to %f.\n", step_speed_);
+  TENSIXTY_TRACE(TRACE_DEBUG, TRACE_MOTOR, ::tensixty::TRACE_MOTOR_SPEED,
+      address(), TraceSpeed(step_speed_), 0);
   if (step_speed_ > max_speed_) {
     step_speed_ = max_speed_;
   } else if (step_speed_ < min_speed_) {
@@ -1,14 +1,15 @@
 #include "packet.h"
+#include "sync_scanner.h"
+#include "trace.h"
 #include <string.h>
-#include <stdio.h>
 
 namespace tensixty {
-namespace {
-const int NUM_HEADER_BYTES = 7;
-}  // namespace
 
 Ack::Ack() {
   index_and_error_ = 0;
+  memset(selective_, 0, MAX_SACK_BYTES);
+  has_credit_ = false;
+  credit_ = 0;
 }
 
 Ack::Ack(const unsigned char index_and_error) {
@@ -16,19 +17,66 @@ Ack::Ack(const unsigned char index_and_error) {
 }
 
 void Ack::Parse(const unsigned char index_and_error) {
-  index_and_error_ = index_and_error;
+  index_and_error_ = (static_cast<unsigned int>(index_and_error & 0x80) << 8) |
+    (index_and_error & 0x7f);
+  memset(selective_, 0, MAX_SACK_BYTES);
+  has_credit_ = false;
+  credit_ = 0;
 }
 
-void Ack::Parse(bool error, const unsigned char index) {
-  index_and_error_ = (error ? 0x80 : 0x00) | (0x7f & index);
+void Ack::Parse(bool error, const unsigned int index) {
+  index_and_error_ = (error ? 0x8000 : 0x0000) | (0x7fff & index);
+  memset(selective_, 0, MAX_SACK_BYTES);
+  has_credit_ = false;
+  credit_ = 0;
 }
 
-unsigned char Ack::index() const {
-  return index_and_error_ & 0x7f;
+void Ack::ParseExtended(const unsigned int index_and_error) {
+  index_and_error_ = index_and_error & 0xffff;
+  memset(selective_, 0, MAX_SACK_BYTES);
+  has_credit_ = false;
+  credit_ = 0;
+}
+
+void Ack::SetCredit(const unsigned int credit) {
+  has_credit_ = true;
+  credit_ = credit < 255 ? credit : 255;
+}
+
+void Ack::SetSelective(const unsigned int offset) {
+  if (offset >= MAX_SACK_BYTES * 8) return;
+  selective_[offset / 8] |= 1 << (offset % 8);
+}
+
+bool Ack::selective(const unsigned int offset) const {
+  if (offset >= MAX_SACK_BYTES * 8) return false;
+  return selective_[offset / 8] & (1 << (offset % 8));
+}
+
+bool Ack::has_selective() const {
+  return selective_size() != 0;
+}
+
+unsigned int Ack::selective_size() const {
+  unsigned int used = MAX_SACK_BYTES;
+  while (used > 0 && selective_[used - 1] == 0) --used;
+  if (used == 0) return 0;
+  unsigned int size = 2;
+  while (size < used) size *= 2;
+  return size;
+}
+
+void Ack::ParseSelective(const unsigned char *bitmap, const unsigned int size) {
+  memset(selective_, 0, MAX_SACK_BYTES);
+  memcpy(selective_, bitmap, size < MAX_SACK_BYTES ? size : MAX_SACK_BYTES);
+}
+
+unsigned int Ack::index() const {
+  return index_and_error_ & 0x7fff;
 }
 
 bool Ack::error() const {
-  return 0x80 == (index_and_error_ & 0x80);
+  return 0x8000 == (index_and_error_ & 0x8000);
 }
 
 bool Ack::ok() const {
@@ -36,53 +84,98 @@ bool Ack::ok() const {
 }
 
 void Ack::AckStartSequence() {
-  index_and_error_ = 0x80;
+  index_and_error_ = 0x8000;
+  memset(selective_, 0, MAX_SACK_BYTES);
+  has_credit_ = false;
+  credit_ = 0;
 }
 
 bool Ack::is_start_sequence_ack() const {
-  return index_and_error_ == 0x80;
+  return index_and_error_ == 0x8000;
 }
 
 const unsigned char Ack::Serialize() const {
+  return ((index_and_error_ >> 8) & 0x80) | (index_and_error_ & 0x7f);
+}
+
+unsigned int Ack::SerializeExtended() const {
   return index_and_error_;
 }
 
 Ack& Ack::operator=(const Ack &other) noexcept {
-  index_and_error_ = other.Serialize();
+  index_and_error_ = other.SerializeExtended();
+  memcpy(selective_, other.selective_bitmap(), MAX_SACK_BYTES);
+  has_credit_ = other.has_credit();
+  credit_ = other.credit();
   return *this;
 }
 
 Packet::Packet() {
   Reset();
+  WriteHeader();
+  WriteDataChecksum();
 }
 
 void Packet::Reset() {
   parsed_ = false;
   error_ = false;
+  compact_ = false;
+  start_flag_ = false;
+  header_done_ = false;
   header_next_byte_index_ = 0;
   data_next_byte_index_ = 0;
   ack_.Parse(0x00);
 
-  header_first_checksum_ = 0;
-  header_second_checksum_ = 0;
-  data_first_checksum_ = 0;
-  data_second_checksum_ = 0;
+  header_checksum_.Reset();
+  data_checksum_.Reset();
 }
 
 ParseStatus Packet::ParseChar(const unsigned char c) {
-  ParseStatus status = ParseCharInternal(c);
+  return FinishParse(ParseCharInternal(c));
+}
+
+ParseStatus Packet::Parse(const unsigned char *buf, const size_t length, size_t *consumed) {
+  ParseStatus status = INCOMPLETE;
+  size_t i = 0;
+  while (i < length && status == INCOMPLETE) {
+    if (header_next_byte_index_ == 0) {
+      // Skip junk between frames in one go. Every skipped byte would have been
+      // a header error, so they are reported as a single one.
+      const unsigned char *frame_start = FindFrameStart(buf + i, length - i);
+      if (frame_start != buf + i) {
+        i = frame_start - buf;
+        status = HEADER_ERROR;
+        break;
+      }
+    }
+    if (header_next_byte_index_ >= header_size_ &&
+        data_next_byte_index_ < static_cast<const unsigned int>(data_length_)) {
+      // Mid-payload: take everything available up to the checksum bytes.
+      size_t count = data_length_ - data_next_byte_index_;
+      if (count > length - i) count = length - i;
+      ParseDataBlock(buf + i, count);
+      i += count;
+      continue;
+    }
+    status = ParseCharInternal(buf[i]);
+    ++i;
+  }
+  *consumed = i;
+  return FinishParse(status);
+}
+
+ParseStatus Packet::FinishParse(ParseStatus status) {
   if (status == HEADER_ERROR || status == DATA_ERROR) {
-    //printf("Reprocess %d for char %d, status %d\n", status, c, status);
-    const ParseStatus adjusted_status = ReProcessPacket();
+    const ParseStatus adjusted_status = Resync();
     if (adjusted_status == INCOMPLETE || adjusted_status == PARSED) {
-      printf("Reprocess looks good 2\n");
       status = adjusted_status;
     }
   }
   switch (status) {
     case PARSED:
       parsed_ = true;
-      printf("Parsed! Packet %d with %d bytes, ack = %d\n", index_sending_, data_length_, ack_.Serialize());
+      TENSIXTY_TRACE(TRACE_DEBUG, TRACE_PACKET, TRACE_PACKET_PARSED,
+          index_sending_, data_length_, ack_.Serialize());
       break;
     case HEADER_ERROR:
       Reset();
@@ -98,116 +191,153 @@ ParseStatus Packet::ParseChar(const unsigned char c) {
   return status;
 }
 
-ParseStatus Packet::ReProcessPacket() {
-  unsigned char byte_stream[7 + 258];
-  unsigned int num_bytes;
-  Serialize(byte_stream, byte_stream + 7 * sizeof(unsigned char), &num_bytes);
-  if (header_next_byte_index_ < NUM_HEADER_BYTES) {
-    num_bytes = header_next_byte_index_;
-  } else {
-    num_bytes = data_next_byte_index_;
-  }
-  //printf("ReProcess: Num bytes = %d\n", num_bytes);
-  ParseStatus status = HEADER_ERROR;
-  for (unsigned int start = 1; start < num_bytes; ++start) {
-    Reset();
-    printf("ReProcess from start = %d\n", start);
-    int i = start;
-    for (; i < num_bytes; ++i) {
-      status = ParseCharInternal(byte_stream[i]);
-      printf("ReProcess %d -> %d\n", i , status);
-      if (status == HEADER_ERROR || status == DATA_ERROR) {
-        break;
-      }
-    }
-    if (status == INCOMPLETE || status == PARSED) {
-      printf("ReProcess looks good!\n");
-      return status;
-    }
-  }
-  return status;
-}
-
-
 ParseStatus Packet::ParseCharInternal(const unsigned char c) {
-  if (header_next_byte_index_ < NUM_HEADER_BYTES) {
+  if (header_next_byte_index_ < header_size_) {
     return ParseHeaderChar(c);
   } else {
     return ParseDataChar(c);
   }
 }
 
-namespace {
-void UpdateChecksum(const unsigned char c, unsigned char *first_sum, unsigned char *second_sum) {
-  *first_sum += c;
-  *second_sum += *first_sum;
+// Returns true if the frame starting at start of the given bytes, whose header
+// has already been validated, has correct data checksums for every checksum
+// byte present.
+bool Packet::CandidateDataValid(const unsigned int start, const unsigned int num_bytes) const {
+  const unsigned char format = frame_[start + 1];
+  if (format == ACK_FRAME || format == EXTENDED_ACK_FRAME) return true;
+  const unsigned int header_size = FrameHeaderSize(frame_ + start);
+  const unsigned int data_start = start + header_size;
+  // The length is always the last byte before the header checksum.
+  const unsigned int data_end = data_start + frame_[data_start - 3];
+  Fletcher checksum;
+  checksum.Update(frame_ + data_start, (num_bytes < data_end ? num_bytes : data_end) - data_start);
+  if (data_end < num_bytes && frame_[data_end] != checksum.first()) return false;
+  if (data_end + 1 < num_bytes && frame_[data_end + 1] != checksum.second()) return false;
+  return true;
 }
+
+ParseStatus Packet::Resync() {
+  // Every byte of the failed frame, including the one that failed it. Bytes
+  // past those received are left over from an earlier frame.
+  const unsigned int num_bytes = header_done_ ?
+    header_size_ + data_next_byte_index_ + 1 : header_next_byte_index_;
+
+  unsigned int start = 1;
+  while (start < num_bytes) {
+    // Skips positions without start bytes, or whose header fails its checksum.
+    start = FindFrameStart(frame_ + start, num_bytes - start) - frame_;
+    if (start >= num_bytes) break;
+    if (num_bytes - start >= 3) {
+      const unsigned int header_size = FrameHeaderSize(frame_ + start);
+      if (start + header_size <= num_bytes && !CandidateDataValid(start, num_bytes)) {
+        ++start;
+        continue;
+      }
+    }
+    // Either a verified frame, or a short tail that may be the start of one.
+    // Parsing it again moves it to the front of frame_; each byte is read
+    // before anything is written over it.
+    Reset();
+    ParseStatus status = INCOMPLETE;
+    for (unsigned int i = start; i < num_bytes && status == INCOMPLETE; ++i) {
+      status = ParseCharInternal(frame_[i]);
+    }
+    if (status == INCOMPLETE || status == PARSED) {
+      return status;
+    }
+    ++start;
+  }
+  return HEADER_ERROR;
 }
 
 ParseStatus Packet::ParseHeaderChar(const unsigned char c) {
   //printf("Parsing %d, header_index = %d\n", c, header_next_byte_index_);
+  frame_[header_next_byte_index_] = c;
+  const unsigned int position = header_next_byte_index_++;
   bool error = false;
-  switch (header_next_byte_index_) {
-    case 0: {
-      if (c != 10) error = true;
-      break;
-    }
-    case 1: {
-      if (c != 60) error = true;
-      break;
-    }
-    case 2: {
-      ack_.Parse(c);
-      break;
-    }
-    case 3: {
-      index_sending_ = c;
-      break;
+  if (position == 0) {
+    if (c != FRAME_START_BYTE) error = true;
+  } else if (position == 1) {
+    if ((c & 0xfc) != FRAME_FORMAT_BASE) error = true;
+  } else if (position == 2) {
+    header_size_ = FrameHeaderSize(frame_);
+    if (header_size_ == 0) {
+      header_size_ = HEADER_SIZE;
+      error = true;
     }
-    case 4: {
-      data_length_ = c;
-      break;
-    }
-    case 5: {
-      if (c != header_first_checksum_) {
-        printf("Header mismatch %d expected\n", header_first_checksum_);
-        error = true;
-      } else {
-        ++header_next_byte_index_;
-        return INCOMPLETE;
-      }
-      break;
+  }
+  if (position >= 2 && position + 2 == header_size_) {
+    if (c != header_checksum_.first()) {
+      TENSIXTY_TRACE(TRACE_INFO, TRACE_PACKET, TRACE_HEADER_CHECKSUM_ERROR,
+          header_checksum_.first(), c, 0);
+      return HEADER_ERROR;
     }
-    case 6: {
-      if (c != header_second_checksum_) {
-        error = true;
-      } else {
-        ++header_next_byte_index_;
-        return INCOMPLETE;
-      }
-      break;
+    return INCOMPLETE;
+  }
+  if (position >= 2 && position + 1 == header_size_) {
+    if (c != header_checksum_.second()) {
+      return HEADER_ERROR;
     }
+    DecodeHeader();
+    header_done_ = true;
+    return compact_ ? PARSED : INCOMPLETE;
   }
-  ++header_next_byte_index_;
   if (error) {
     return HEADER_ERROR;
   }
-  UpdateChecksum(c, &header_first_checksum_, &header_second_checksum_);
+  header_checksum_.Update(c);
   return INCOMPLETE;
 }
 
+void Packet::DecodeHeader() {
+  extended_ = frame_[1] == EXTENDED_FRAME || frame_[1] == EXTENDED_ACK_FRAME;
+  compact_ = frame_[1] == ACK_FRAME || frame_[1] == EXTENDED_ACK_FRAME;
+  channel_ = 0;
+  start_flag_ = false;
+  if (compact_) {
+    index_sending_ = 0;
+    data_length_ = 0;
+    if (extended_) {
+      ack_.ParseExtended((static_cast<unsigned int>(frame_[3]) << 8) | frame_[4]);
+      ParseOptionalFields(frame_ + 5);
+    } else {
+      ack_.Parse(frame_[2]);
+    }
+    return;
+  }
+  if (extended_) {
+    ack_.ParseExtended((static_cast<unsigned int>(frame_[3]) << 8) | frame_[4]);
+    index_sending_ = ((static_cast<unsigned int>(frame_[5]) << 8) | frame_[6]) & MAX_EXTENDED_INDEX;
+    ParseOptionalFields(frame_ + 7);
+  } else {
+    ack_.Parse(frame_[2]);
+    index_sending_ = frame_[3];
+  }
+  data_length_ = frame_[header_size_ - 3];
+}
+
+void Packet::ParseDataBlock(const unsigned char *buf, const size_t length) {
+  memcpy(frame_ + header_size_ + data_next_byte_index_, buf, length);
+  data_checksum_.Update(buf, length);
+  data_next_byte_index_ += length;
+}
+
 ParseStatus Packet::ParseDataChar(const unsigned char c) {
+  if (data_next_byte_index_ <= static_cast<const unsigned int>(data_length_) + 1) {
+    frame_[header_size_ + data_next_byte_index_] = c;
+  }
   if (data_next_byte_index_ < static_cast<const unsigned int>(data_length_)) {
-    data_[data_next_byte_index_] = c;
-    UpdateChecksum(c, &data_first_checksum_, &data_second_checksum_);
+    data_checksum_.Update(c);
   } else if (data_next_byte_index_ == static_cast<const unsigned int>(data_length_)) {
-    if (c != data_first_checksum_) {
-      printf("Checksum expected %d != actual %d\n", data_first_checksum_, c);
+    if (c != data_checksum_.first()) {
+      TENSIXTY_TRACE(TRACE_INFO, TRACE_PACKET, TRACE_DATA_CHECKSUM_ERROR,
+          data_checksum_.first(), c, 0);
       return DATA_ERROR;
     }
   } else if (data_next_byte_index_ == static_cast<const unsigned int>(data_length_) + 1) {
-    if (c != data_second_checksum_) {
-      printf("Checksum expected %d != actual %d\n", data_second_checksum_, c);
+    if (c != data_checksum_.second()) {
+      TENSIXTY_TRACE(TRACE_INFO, TRACE_PACKET, TRACE_DATA_CHECKSUM_ERROR,
+          data_checksum_.second(), c, 0);
       return DATA_ERROR;
     }
     return PARSED;
@@ -218,44 +348,159 @@ ParseStatus Packet::ParseDataChar(const unsigned char c) {
 
 const unsigned char* Packet::data(unsigned char *length) const {
   *length = data_length_;
-  return data_;
+  return frame_ + header_size_;
+}
+
+const unsigned char* Packet::frame(unsigned int *length) const {
+  *length = compact_ ? header_size_ : header_size_ + data_length_ + 2;
+  return frame_;
 }
 
 void Packet::IncludeAck(const Ack &ack) {
   ack_ = ack;
+  WriteHeader();
+}
+
+void Packet::IncludeData(const unsigned int index, const unsigned char *data, const unsigned int data_length) {
+  IncludeData(index, nullptr, 0, data, data_length);
 }
 
-void Packet::IncludeData(const unsigned char index, const unsigned char *data, const unsigned int data_length) {
+void Packet::IncludeData(const unsigned int index, const unsigned char *prefix,
+    const unsigned int prefix_length, const unsigned char *data, const unsigned int data_length) {
+  const unsigned char *pieces[2] = {prefix, data};
+  const unsigned int lengths[2] = {prefix_length, data_length};
+  IncludeData(index, pieces, lengths, 2);
+}
+
+void Packet::IncludeData(const unsigned int index, const unsigned char *const *pieces,
+    const unsigned int *lengths, const unsigned int count) {
   index_sending_ = index;
-  data_length_ = data_length;
-  if (data_length_ > 0) {
-    memcpy(data_, data, data_length * sizeof(unsigned char));
+  unsigned int length = 0;
+  for (unsigned int i = 0; i < count; ++i) {
+    if (lengths[i] > 0) memcpy(frame_ + header_size_ + length, pieces[i], lengths[i]);
+    length += lengths[i];
   }
+  data_length_ = length;
+  WriteHeader();
+  WriteDataChecksum();
 }
 
-void Packet::Serialize(unsigned char *header, unsigned char *data, unsigned int *data_bytes) const {
-  header[0] = 10;
-  header[1] = 60;
-  header[2] = ack_.Serialize();
-  header[3] = index_sending_;
-  header[4] = data_length_;
-  unsigned char ck_0 = 0;
-  unsigned char ck_1 = 0;
-  for (int i = 0; i < 5; ++i) {
-    UpdateChecksum(header[i], &ck_0, &ck_1);
+void Packet::UseExtendedHeader(const bool extended) {
+  extended_ = extended;
+  WriteHeader();
+}
+
+void Packet::UseCompactAck(const bool compact) {
+  compact_ = compact;
+  WriteHeader();
+}
+
+void Packet::UseChannel(const unsigned int channel) {
+  channel_ = channel & 0xff;
+  WriteHeader();
+}
+
+void Packet::MarkStartSequence() {
+  start_flag_ = true;
+  WriteHeader();
+}
+
+unsigned char Packet::ExtendedFlags() const {
+  const unsigned int sack_size = ack_.selective_size();
+  return (sack_size == 0 ? 0 : sack_size == 2 ? 1 : sack_size == 4 ? 2 : 3) |
+    (ack_.has_credit() ? FLAGS_CREDIT : 0) |
+    (channel_ != 0 ? FLAGS_CHANNEL : 0) |
+    (start_flag_ ? FLAGS_START : 0);
+}
+
+unsigned int Packet::WriteOptionalFields(unsigned char *fields) const {
+  unsigned int size = ack_.selective_size();
+  memcpy(fields, ack_.selective_bitmap(), size);
+  if (ack_.has_credit()) fields[size++] = ack_.credit();
+  if (channel_ != 0) fields[size++] = channel_;
+  return size;
+}
+
+void Packet::ParseOptionalFields(const unsigned char *fields) {
+  const unsigned char flags = frame_[2];
+  unsigned int offset = SackBitmapSize(flags);
+  ack_.ParseSelective(fields, offset);
+  if (flags & FLAGS_CREDIT) ack_.SetCredit(fields[offset++]);
+  channel_ = flags & FLAGS_CHANNEL ? fields[offset] : 0;
+  start_flag_ = flags & FLAGS_START;
+}
+
+void Packet::ResizeHeader(const unsigned int header_size) {
+  if (header_size == header_size_) return;
+  memmove(frame_ + header_size, frame_ + header_size_, data_length_ + 2);
+  header_size_ = header_size;
+}
+
+void Packet::WriteHeader() {
+  frame_[0] = FRAME_START_BYTE;
+  if (compact_) {
+    WriteCompactAck();
+    return;
   }
-  header[5] = ck_0;
-  header[6] = ck_1;
-
-  ck_0 = 0;
-  ck_1 = 0;
-  *data_bytes = data_length_ + 2;
-  for (int i = 0; i < data_length_; ++i) {
-    data[i] = data_[i];
-    UpdateChecksum(data[i], &ck_0, &ck_1);
+  if (extended_) {
+    const unsigned int ack = ack_.SerializeExtended();
+    unsigned char fields[MAX_SACK_BYTES + CREDIT_SIZE + CHANNEL_SIZE];
+    const unsigned int fields_size = WriteOptionalFields(fields);
+    ResizeHeader(EXTENDED_HEADER_SIZE + fields_size);
+    frame_[1] = EXTENDED_FRAME;
+    frame_[2] = ExtendedFlags();
+    frame_[3] = ack >> 8;
+    frame_[4] = ack & 0xff;
+    frame_[5] = index_sending_ >> 8;
+    frame_[6] = index_sending_ & 0xff;
+    memcpy(frame_ + 7, fields, fields_size);
+  } else {
+    // Basic headers have no room for selective acks.
+    ResizeHeader(HEADER_SIZE);
+    frame_[1] = BASIC_FRAME;
+    frame_[2] = ack_.Serialize();
+    frame_[3] = index_sending_;
   }
-  data[data_length_] = ck_0;
-  data[data_length_ + 1] = ck_1;
+  frame_[header_size_ - 3] = data_length_;
+  Fletcher checksum;
+  checksum.Update(frame_, header_size_ - 2);
+  frame_[header_size_ - 2] = checksum.first();
+  frame_[header_size_ - 1] = checksum.second();
+}
+
+void Packet::WriteCompactAck() {
+  if (extended_) {
+    const unsigned int ack = ack_.SerializeExtended();
+    unsigned char fields[MAX_SACK_BYTES + CREDIT_SIZE + CHANNEL_SIZE];
+    const unsigned int fields_size = WriteOptionalFields(fields);
+    ResizeHeader(EXTENDED_ACK_FRAME_SIZE + fields_size);
+    frame_[1] = EXTENDED_ACK_FRAME;
+    frame_[2] = ExtendedFlags();
+    frame_[3] = ack >> 8;
+    frame_[4] = ack & 0xff;
+    memcpy(frame_ + 5, fields, fields_size);
+  } else {
+    ResizeHeader(ACK_FRAME_SIZE);
+    frame_[1] = ACK_FRAME;
+    frame_[2] = ack_.Serialize();
+  }
+  Fletcher checksum;
+  checksum.Update(frame_, header_size_ - 2);
+  frame_[header_size_ - 2] = checksum.first();
+  frame_[header_size_ - 1] = checksum.second();
+}
+
+void Packet::WriteDataChecksum() {
+  Fletcher checksum;
+  checksum.Update(frame_ + header_size_, data_length_);
+  frame_[header_size_ + data_length_] = checksum.first();
+  frame_[header_size_ + data_length_ + 1] = checksum.second();
+}
+
+void Packet::Serialize(unsigned char *header, unsigned char *data, unsigned int *data_bytes) const {
+  memcpy(header, frame_, header_size_);
+  *data_bytes = compact_ ? 0 : data_length_ + 2;
+  memcpy(data, frame_ + header_size_, *data_bytes);
 }
 
 }  // namespace tensixty
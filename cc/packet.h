@@ -1,8 +1,32 @@
 #ifndef TENSIXTY_PACKET_H_
 #define TENSIXTY_PACKET_H_
 
+#include <stddef.h>
+#include "checksum.h"
+
 namespace tensixty {
 
+// Bytes in a basic frame header, an extended frame header, and the largest
+// frame. Basic frames carry 7-bit indices; extended frames carry 15-bit ones.
+const unsigned int HEADER_SIZE = 7;
+const unsigned int EXTENDED_HEADER_SIZE = 10;
+// Largest selective ack bitmap an extended header may carry, and the sizes of
+// its optional receive window credit and channel.
+const unsigned int MAX_SACK_BYTES = 8;
+const unsigned int CREDIT_SIZE = 1;
+const unsigned int CHANNEL_SIZE = 1;
+const unsigned int MAX_HEADER_SIZE =
+  EXTENDED_HEADER_SIZE + MAX_SACK_BYTES + CREDIT_SIZE + CHANNEL_SIZE;
+const unsigned int MAX_DATA_SIZE = 255;
+const unsigned int MAX_FRAME_SIZE = MAX_HEADER_SIZE + MAX_DATA_SIZE + 2;
+// Bytes in compact ack-only frames, before any selective ack bitmap.
+const unsigned int ACK_FRAME_SIZE = 5;
+const unsigned int EXTENDED_ACK_FRAME_SIZE = 7;
+
+// Largest sequence index in each header format. Index 0 carries no data.
+const unsigned int MAX_BASIC_INDEX = 0x7f;
+const unsigned int MAX_EXTENDED_INDEX = 0x7fff;
+
 enum ParseStatus {
   PARSED,
   HEADER_ERROR,
@@ -13,19 +37,45 @@ enum ParseStatus {
 class Ack {
  public:
    Ack();
+   // From the ack byte of a basic header.
    explicit Ack(const unsigned char index_and_error);
    void Parse(const unsigned char index_and_error);
-   void Parse(bool error, const unsigned char index);
+   void Parse(bool error, const unsigned int index);
+   // From the two ack bytes of an extended header.
+   void ParseExtended(const unsigned int index_and_error);
    void AckStartSequence();
+   // Ack byte for a basic header. Only valid for indices up to MAX_BASIC_INDEX.
    const unsigned char Serialize() const;
-   unsigned char index() const;
+   // Ack bytes for an extended header.
+   unsigned int SerializeExtended() const;
+   unsigned int index() const;
    bool error() const;
    bool ok() const;
    bool is_start_sequence_ack() const;
    Ack& operator=(const Ack &other) noexcept;
 
+   // Selective acks, for links that negotiate them. Bit offset marks index
+   // index() + 1 + offset as received, and index() is then cumulative.
+   void SetSelective(unsigned int offset);
+   bool selective(unsigned int offset) const;
+   bool has_selective() const;
+   // Bitmap bytes needed on the wire: 0, 2, 4 or 8.
+   unsigned int selective_size() const;
+   const unsigned char* selective_bitmap() const { return selective_; }
+   void ParseSelective(const unsigned char *bitmap, unsigned int size);
+
+   // Receive window credit, for links that negotiate it: the other end may
+   // send packets with indices up to index() + credit(). Saturates at 255.
+   void SetCredit(unsigned int credit);
+   bool has_credit() const { return has_credit_; }
+   unsigned int credit() const { return credit_; }
+
  private:
-   unsigned char index_and_error_;
+   // Error in the top bit, index in the low 15 bits.
+   unsigned int index_and_error_;
+   unsigned char selective_[MAX_SACK_BYTES];
+   bool has_credit_;
+   unsigned char credit_;
 };
 
 class Packet {
@@ -34,47 +84,110 @@ class Packet {
   void Reset();
 
   ParseStatus ParseChar(const unsigned char c);
+  // Parses bytes from buf until the packet is complete or fails, or until the
+  // buffer runs out. The number of bytes used is written to consumed. Returns
+  // what ParseChar would have returned for the last byte consumed; payload
+  // bytes are copied in bulk rather than one at a time, and a run of bytes
+  // that cannot start a frame is skipped as a single HEADER_ERROR.
+  ParseStatus Parse(const unsigned char *buf, size_t length, size_t *consumed);
 
   // Accessors
   const Ack& ack() const { return ack_; }
-  unsigned char index_sending() const { return index_sending_; }
+  unsigned int index_sending() const { return index_sending_; }
   const unsigned char *data(unsigned char *length) const;
+  // True if the frame uses the extended header.
+  bool extended() const { return extended_; }
+  unsigned int header_size() const { return header_size_; }
+  // True if the frame is a compact ack-only frame.
+  bool compact() const { return compact_; }
   // True if the message is completely parsed.
   bool parsed() const { return parsed_; }
   // True if the message encountered an error while parsing.
   bool error() const { return error_; }
-  // True if the message indicates a new connection.
-  bool start_sequence() const { return index_sending_ == 0x80; }
+  // True if the message indicates a new connection. Start sequences are sent
+  // with a basic header, except on channels other than 0, which flag them.
+  bool start_sequence() const { return start_flag_ || (!extended_ && index_sending_ == 0x80); }
+  // True if the frame is a datagram: data outside the sequence, at index 0.
+  bool datagram() const { return index_sending_ == 0 && data_length_ > 0 && !start_sequence(); }
+  // Logical channel; always 0 with the basic header.
+  unsigned int channel() const { return channel_; }
 
   // Builder
   void IncludeAck(const Ack &ack);
-  void IncludeData(const unsigned char index, const unsigned char *data, unsigned int data_length);
-
-  // Copys the contents out to another pair of arrays, header and data_bytes. Header must be at least 7 bytes long,
-  // and data must be at least 258 bytes long.
+  void IncludeData(const unsigned int index, const unsigned char *data, unsigned int data_length);
+  // Same, with the payload in two pieces, so a prefix such as a header needs
+  // no copy of its own ahead of the data.
+  void IncludeData(unsigned int index, const unsigned char *prefix, unsigned int prefix_length,
+      const unsigned char *data, unsigned int data_length);
+  // Same, with the payload gathered from count pieces, in order.
+  void IncludeData(unsigned int index, const unsigned char *const *pieces,
+      const unsigned int *lengths, unsigned int count);
+  // Switches between the basic and the extended header, keeping the contents.
+  void UseExtendedHeader(bool extended);
+  // Sends just the ack, in a compact frame. Only for packets without data.
+  void UseCompactAck(bool compact);
+  // Carries the packet on a logical channel. Only the extended header has
+  // room for channels other than 0.
+  void UseChannel(unsigned int channel);
+  // Flags an extended frame as a start sequence.
+  void MarkStartSequence();
+
+  // The complete frame as it goes on the wire: header, data and data checksum.
+  // Kept up to date by the builder methods, and filled in as bytes are parsed.
+  const unsigned char* frame(unsigned int *length) const;
+
+  // Copys the contents out to another pair of arrays, header and data_bytes. Header must be at least
+  // header_size() bytes long, and data must be at least 258 bytes long.
   void Serialize(unsigned char *header, unsigned char *data, unsigned int *data_bytes) const;
 
  private:
+  // Applies error recovery and bookkeeping to the status of the last byte.
+  ParseStatus FinishParse(ParseStatus status);
   ParseStatus ParseCharInternal(const unsigned char c);
   ParseStatus ParseHeaderChar(const unsigned char c);
   ParseStatus ParseDataChar(const unsigned char c);
-  ParseStatus ReProcessPacket();
+  // Reads the fields out of a complete, verified header.
+  void DecodeHeader();
+  // Stores payload bytes; length must not run past the end of the payload.
+  void ParseDataBlock(const unsigned char *buf, size_t length);
+  // Looks for the start of a valid frame among the bytes of the frame that
+  // just failed, in linear time. Leaves the packet parsing that frame and
+  // returns INCOMPLETE or PARSED if one is found.
+  ParseStatus Resync();
+  bool CandidateDataValid(unsigned int start, unsigned int num_bytes) const;
+  // Rebuild the parts of frame_ that depend on the builder inputs.
+  void WriteHeader();
+  // Rebuilds frame_ as a compact ack-only frame.
+  void WriteCompactAck();
+  // The flags byte of an extended header, and the optional fields it
+  // announces: selective acks, credit and channel.
+  unsigned char ExtendedFlags() const;
+  // Returns the bytes written.
+  unsigned int WriteOptionalFields(unsigned char *fields) const;
+  void ParseOptionalFields(const unsigned char *fields);
+  // Moves the payload and its checksum to follow a header of the given size.
+  void ResizeHeader(unsigned int header_size);
+  void WriteDataChecksum();
 
   Ack ack_;
-  unsigned char index_sending_ = 0;
-  unsigned char data_[256];
+  unsigned int index_sending_ = 0;
+  unsigned char frame_[MAX_FRAME_SIZE];
   unsigned char data_length_ = 0;
+  bool extended_ = false;
+  bool compact_ = false;
+  unsigned char channel_ = 0;
+  bool start_flag_ = false;
+  unsigned int header_size_ = HEADER_SIZE;
   bool parsed_, error_;
 
-  // Partial data while parsing.
+  // Partial data while parsing. The header is done once it passed its
+  // checksum; any failure after that came in the data.
+  bool header_done_;
   unsigned int header_next_byte_index_;
   unsigned int data_next_byte_index_;
 
-  unsigned char header_first_checksum_;
-  unsigned char header_second_checksum_;
-
-  unsigned char data_first_checksum_;
-  unsigned char data_second_checksum_;
+  Fletcher header_checksum_;
+  Fletcher data_checksum_;
 };
 
 }  // namespace tensixty
@@ -0,0 +1,206 @@
+#include "posix_serial.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/serial.h>
+#endif
+
+namespace tensixty {
+namespace {
+
+// The termios constant for a baud rate, or B0 if there is none.
+speed_t SpeedFor(const unsigned long baud) {
+  switch (baud) {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+#if defined(B460800)
+    case 460800: return B460800;
+#endif
+#if defined(B500000)
+    case 500000: return B500000;
+#endif
+#if defined(B921600)
+    case 921600: return B921600;
+#endif
+#if defined(B1000000)
+    case 1000000: return B1000000;
+#endif
+#if defined(B2000000)
+    case 2000000: return B2000000;
+#endif
+    default: return B0;
+  }
+}
+
+// Best effort; ptys and many drivers don't support it.
+void SetLowLatency(const int fd) {
+#if defined(__linux__) && defined(ASYNC_LOW_LATENCY)
+  struct serial_struct serial;
+  if (ioctl(fd, TIOCGSERIAL, &serial) != 0) return;
+  serial.flags |= ASYNC_LOW_LATENCY;
+  ioctl(fd, TIOCSSERIAL, &serial);
+#endif
+}
+
+// Milliseconds on a clock that never steps.
+long MonotonicMillis() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+}  // namespace
+
+PosixSerial::PosixSerial()
+  : fd_(-1), write_timeout_ms_(0), tx_buffer_size_(PosixSerialConfig().tx_buffer_size) {}
+
+PosixSerial::~PosixSerial() {
+  Close();
+}
+
+bool PosixSerial::Open(const char *path, const PosixSerialConfig &config) {
+  Close();
+  fd_ = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd_ < 0) return false;
+  if (!Configure(config)) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+bool PosixSerial::OpenPtyPair(PosixSerial *master, PosixSerial *slave,
+    const PosixSerialConfig &config) {
+  master->Close();
+  master->fd_ = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (master->fd_ < 0) return false;
+  const char *slave_path = nullptr;
+  if (grantpt(master->fd_) == 0 && unlockpt(master->fd_) == 0) {
+    slave_path = ptsname(master->fd_);
+  }
+  // The line settings are shared, so configuring the slave end sets both.
+  if (slave_path == nullptr || !slave->Open(slave_path, config)) {
+    master->Close();
+    return false;
+  }
+  master->write_timeout_ms_ = config.write_timeout_ms;
+  master->tx_buffer_size_ = config.tx_buffer_size;
+  return true;
+}
+
+bool PosixSerial::Configure(const PosixSerialConfig &config) {
+  const speed_t speed = SpeedFor(config.baud);
+  if (speed == B0) return false;
+  struct termios tio;
+  if (tcgetattr(fd_, &tio) != 0) return false;
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cflag &= ~CSTOPB;
+#if defined(CRTSCTS)
+  tio.c_cflag &= ~CRTSCTS;
+#endif
+  tio.c_cc[VMIN] = config.vmin;
+  tio.c_cc[VTIME] = config.vtime;
+  if (cfsetispeed(&tio, speed) != 0 || cfsetospeed(&tio, speed) != 0) return false;
+  if (tcsetattr(fd_, TCSANOW, &tio) != 0) return false;
+  if (config.low_latency) SetLowLatency(fd_);
+  tcflush(fd_, TCIOFLUSH);
+  write_timeout_ms_ = config.write_timeout_ms;
+  tx_buffer_size_ = config.tx_buffer_size;
+  return true;
+}
+
+void PosixSerial::Close() {
+  if (fd_ >= 0) close(fd_);
+  fd_ = -1;
+}
+
+void PosixSerial::write(const unsigned char c) {
+  write(&c, 1);
+}
+
+unsigned char PosixSerial::read() {
+  unsigned char c = 0xff;
+  read(&c, 1);
+  return c;
+}
+
+bool PosixSerial::available() {
+  return available_bytes() > 0;
+}
+
+bool PosixSerial::WaitForRoom(const size_t length) {
+  // Longer than the whole buffer can never fit, so it goes out as room comes.
+  if (length > tx_buffer_size_) return true;
+  const long start = MonotonicMillis();
+  while (available_for_write() < length) {
+    if (MonotonicMillis() - start >= write_timeout_ms_) return false;
+    // POLLOUT fires with any room at all, so sleep in short steps instead.
+    poll(nullptr, 0, 1);
+  }
+  return true;
+}
+
+size_t PosixSerial::write(const unsigned char *buf, const size_t length) {
+  if (fd_ < 0) return 0;
+  // A frame cut short would only be dropped at the other end, and would
+  // garble the one after it, so nothing goes out unless it all fits.
+  if (!WaitForRoom(length)) return 0;
+  size_t written = 0;
+  while (written < length) {
+    const ssize_t result = ::write(fd_, buf + written, length - written);
+    if (result > 0) {
+      written += result;
+      continue;
+    }
+    if (result < 0 && errno == EINTR) continue;
+    if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK) break;
+    // Full after all, if the driver holds less than tx_buffer_size_; finish
+    // what was started.
+    struct pollfd out = {fd_, POLLOUT, 0};
+    if (poll(&out, 1, write_timeout_ms_) <= 0) break;
+  }
+  return written;
+}
+
+size_t PosixSerial::read(unsigned char *buf, const size_t length) {
+  if (fd_ < 0 || length == 0) return 0;
+  ssize_t result;
+  do {
+    result = ::read(fd_, buf, length);
+  } while (result < 0 && errno == EINTR);
+  // EAGAIN when there is nothing yet, and EIO on a pty whose other end is
+  // closed.
+  return result > 0 ? result : 0;
+}
+
+size_t PosixSerial::available_for_write() {
+  int queued = 0;
+  if (fd_ < 0) return 0;
+  if (ioctl(fd_, TIOCOUTQ, &queued) != 0 || queued < 0) {
+    return SerialInterface::available_for_write();
+  }
+  const size_t used = queued;
+  return used < tx_buffer_size_ ? tx_buffer_size_ - used : 0;
+}
+
+size_t PosixSerial::available_bytes() {
+  int bytes = 0;
+  if (fd_ < 0 || ioctl(fd_, FIONREAD, &bytes) != 0 || bytes < 0) return 0;
+  return bytes;
+}
+
+}  // namespace tensixty
@@ -0,0 +1,69 @@
+#ifndef TENSIXTY_POSIX_SERIAL_H_
+#define TENSIXTY_POSIX_SERIAL_H_
+
+#include "serial_interface.h"
+
+namespace tensixty {
+
+struct PosixSerialConfig {
+  // One of the standard termios rates, such as 115200.
+  unsigned long baud = 115200;
+  // Raw mode termios VMIN and VTIME. Reads here never block, so these only
+  // matter to other users of the descriptor.
+  unsigned char vmin = 0;
+  unsigned char vtime = 0;
+  // Asks the driver to pass bytes on without batching them up, where it
+  // supports that, such as Linux UARTs and USB serial adapters.
+  bool low_latency = true;
+  // How long a write may wait for room for all of its bytes.
+  int write_timeout_ms = 100;
+  // Bytes the driver's output buffer holds. Room to write is this less what
+  // is still queued, so it only needs to be a lower bound; Linux UARTs and
+  // USB serial adapters hold at least a page.
+  size_t tx_buffer_size = 4096;
+};
+
+// A serial port on a POSIX host, through termios, in raw mode without flow
+// control. Reads never block. Writes go out whole or not at all: each waits
+// up to write_timeout_ms for room for all of its bytes, and writes nothing if
+// it doesn't come. Only writes longer than tx_buffer_size, far past any frame,
+// go out piecemeal. Not for the Arduino build.
+class PosixSerial : public SerialInterface {
+ public:
+  PosixSerial();
+  ~PosixSerial() override;
+  // Opens and configures a tty, such as /dev/ttyACM0. Returns false if it
+  // can't be opened, or the baud rate is not a standard one.
+  bool Open(const char *path, const PosixSerialConfig &config = PosixSerialConfig());
+  // Opens a pseudo terminal, with master and slave as its two ends, to run
+  // a link on one machine with no hardware.
+  static bool OpenPtyPair(PosixSerial *master, PosixSerial *slave,
+      const PosixSerialConfig &config = PosixSerialConfig());
+  void Close();
+  bool is_open() const { return fd_ >= 0; }
+
+  void write(const unsigned char c) override;
+  unsigned char read() override;
+  bool available() override;
+  size_t write(const unsigned char *buf, size_t length) override;
+  size_t read(unsigned char *buf, size_t length) override;
+  size_t available_bytes() override;
+  // The output buffer size less the bytes still queued in it.
+  size_t available_for_write() override;
+  int fd() override { return fd_; }
+
+ private:
+  // Sets raw mode and the configured speed and timeouts.
+  bool Configure(const PosixSerialConfig &config);
+  // Waits up to write_timeout_ms_ for room to write length bytes. Returns
+  // false if there is none by then.
+  bool WaitForRoom(size_t length);
+
+  int fd_;
+  int write_timeout_ms_;
+  size_t tx_buffer_size_;
+};
+
+}  // namespace tensixty
+
+#endif  // TENSIXTY_POSIX_SERIAL_H_
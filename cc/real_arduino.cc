@@ -47,4 +47,30 @@ bool RealArduino::available() {
   return Serial.available();
 }
 
+size_t RealArduino::write(const unsigned char *buf, const size_t length) {
+  return Serial.write(buf, length);
+}
+
+size_t RealArduino::read(unsigned char *buf, size_t length) {
+  const size_t available = Serial.available();
+  if (length > available) length = available;
+  for (size_t i = 0; i < length; ++i) {
+    buf[i] = (unsigned char) (Serial.read() & 0xff);
+  }
+  return length;
+}
+
+size_t RealArduino::available_bytes() {
+  return Serial.available();
+}
+
+size_t RealArduino::available_for_write() {
+#if defined(ARDUINO) && ARDUINO >= 10606
+  return Serial.availableForWrite();
+#else
+  // Older cores can't report free TX space.
+  return SerialInterface::available_for_write();
+#endif
+}
+
 }  // namespace tensixty
@@ -22,6 +22,10 @@ class RealArduino : public tensixty::ArduinoInterface {
   void write(const unsigned char c) override;
   unsigned char read() override;
   bool available() override;
+  size_t write(const unsigned char *buf, size_t length) override;
+  size_t read(unsigned char *buf, size_t length) override;
+  size_t available_bytes() override;
+  size_t available_for_write() override;
 };
 
 }  // namespace tensixty
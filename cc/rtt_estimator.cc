@@ -0,0 +1,45 @@
+#include "rtt_estimator.h"
+
+namespace tensixty {
+
+RttEstimator::RttEstimator(const unsigned long initial_rto, const unsigned long min_rto,
+    const unsigned long max_rto)
+  : initial_rto_(initial_rto), min_rto_(min_rto), max_rto_(max_rto) {
+  Reset();
+}
+
+void RttEstimator::Reset() {
+  has_sample_ = false;
+  srtt_ = 0;
+  rttvar_ = 0;
+  rto_ = Clamp(initial_rto_);
+}
+
+void RttEstimator::AddSample(const unsigned long rtt) {
+  if (!has_sample_) {
+    // srtt = rtt, rttvar = rtt / 2.
+    srtt_ = rtt << 3;
+    rttvar_ = rtt << 1;
+    has_sample_ = true;
+  } else {
+    // rttvar += (|srtt - rtt| - rttvar) / 4, srtt += (rtt - srtt) / 8.
+    const unsigned long srtt = srtt_ >> 3;
+    const unsigned long error = rtt > srtt ? rtt - srtt : srtt - rtt;
+    rttvar_ = rttvar_ - (rttvar_ >> 2) + error;
+    srtt_ = srtt_ - srtt + rtt;
+  }
+  // rto = srtt + 4 * rttvar.
+  rto_ = Clamp((srtt_ >> 3) + rttvar_);
+}
+
+void RttEstimator::Backoff() {
+  rto_ = Clamp(rto_ > max_rto_ / 2 ? max_rto_ : rto_ * 2);
+}
+
+unsigned long RttEstimator::Clamp(const unsigned long rto) const {
+  if (rto < min_rto_) return min_rto_;
+  if (rto > max_rto_) return max_rto_;
+  return rto;
+}
+
+}  // namespace tensixty
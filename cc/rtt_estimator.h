@@ -0,0 +1,41 @@
+#ifndef TENSIXTY_RTT_ESTIMATOR_H_
+#define TENSIXTY_RTT_ESTIMATOR_H_
+
+namespace tensixty {
+
+// Smoothed round trip time and variance, in the style of Jacobson/Karels
+// (RFC 6298), and the retransmit timeout derived from them. All times are in
+// microseconds.
+class RttEstimator {
+ public:
+  RttEstimator(unsigned long initial_rto, unsigned long min_rto, unsigned long max_rto);
+  // Forgets all samples and any backoff.
+  void Reset();
+  // Adds a measured round trip. Only measure packets sent once, since an ack
+  // for a resent packet may be for either copy. Clears any backoff.
+  void AddSample(unsigned long rtt);
+  // Doubles the timeout after it expired, up to the maximum.
+  void Backoff();
+
+  bool has_sample() const { return has_sample_; }
+  // Zero until the first sample.
+  unsigned long smoothed_rtt() const { return srtt_ >> 3; }
+  unsigned long rtt_variance() const { return rttvar_ >> 2; }
+  unsigned long rto() const { return rto_; }
+
+ private:
+  unsigned long Clamp(unsigned long rto) const;
+
+  const unsigned long initial_rto_;
+  const unsigned long min_rto_;
+  const unsigned long max_rto_;
+  bool has_sample_;
+  // Scaled by 8 and 4, as in the classic integer implementation.
+  unsigned long srtt_;
+  unsigned long rttvar_;
+  unsigned long rto_;
+};
+
+}  // namespace tensixty
+
+#endif  // TENSIXTY_RTT_ESTIMATOR_H_
@@ -1,6 +1,8 @@
 #ifndef serial_interface_h_
 #define serial_interface_h_
 
+#include <stddef.h>
+
 namespace tensixty {
 
 class SerialInterface {
@@ -10,6 +12,35 @@ class SerialInterface {
   virtual void write(const unsigned char c) = 0;
   virtual unsigned char read() = 0;
   virtual bool available() = 0;
+
+  // Bulk transfers. The defaults fall back to the single byte calls above, so
+  // backends only need to override these if they can do better.
+
+  // Writes up to length bytes, returning how many were written.
+  virtual size_t write(const unsigned char *buf, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+      write(buf[i]);
+    }
+    return length;
+  }
+  // Reads up to length bytes that have already arrived, returning how many
+  // were read. Does not wait for more.
+  virtual size_t read(unsigned char *buf, size_t length) {
+    size_t i = 0;
+    while (i < length && available()) {
+      buf[i++] = read();
+    }
+    return i;
+  }
+  // Number of bytes that can be read without waiting. The default can only
+  // tell whether there is at least one.
+  virtual size_t available_bytes() { return available() ? 1 : 0; }
+  // Number of bytes that can be written without waiting. The default assumes
+  // writes never wait.
+  virtual size_t available_for_write() { return static_cast<size_t>(-1); }
+  // A file descriptor that turns readable when bytes arrive, for hosts that
+  // wait in poll() or epoll between ticks. -1 if there is none to wait on.
+  virtual int fd() { return -1; }
 };
 
 }  // namespace tensixty
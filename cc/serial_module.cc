@@ -6,6 +6,7 @@ Message SerialModule::Tick() {
   rx_tx_.Tick();
   unsigned char length;
   const unsigned char* data = rx_tx_.Receive(&length);
+  if (data == nullptr) data = rx_tx_.ReceiveDatagram(&length);
   return Message(length, data);
 }
 
@@ -13,7 +14,25 @@ bool SerialModule::AcceptMessage(const Message &message) {
   if ((message.type() & SERIAL_TYPE_PREFIX) != SERIAL_TYPE_PREFIX) {
     return true;
   }
+  if (IsDatagramType(message.type())) {
+    return rx_tx_.TransmitDatagram(message.raw_data(), message.raw_length(),
+        /*latest_wins=*/true);
+  }
   return rx_tx_.Transmit(message.raw_data(), message.raw_length());
 }
 
+bool SerialModule::SendAsDatagram(const unsigned char message_type) {
+  if (tensixty::MAX_DATAGRAMS == 0) return false;
+  if (num_datagram_types_ >= MAX_DATAGRAM_TYPES) return false;
+  datagram_types_[num_datagram_types_++] = message_type;
+  return true;
+}
+
+bool SerialModule::IsDatagramType(const unsigned char message_type) const {
+  for (int i = 0; i < num_datagram_types_; ++i) {
+    if (datagram_types_[i] == message_type) return true;
+  }
+  return false;
+}
+
 }  // namespace markbot
@@ -9,17 +9,27 @@
 namespace markbot {
 
 const unsigned char SERIAL_TYPE_PREFIX = 0x80;
+const int MAX_DATAGRAM_TYPES = 4;
 
 class SerialModule : public Module {
  public:
   SerialModule(const tensixty::Clock &clock,
-      tensixty::SerialInterface *serial) : rx_tx_(/*name=*/0, clock, serial) {}
+      tensixty::SerialInterface *serial)
+    : rx_tx_(/*name=*/0, clock, serial), num_datagram_types_(0) {}
 
   Message Tick() override;
   bool AcceptMessage(const Message &message) override;
+  // Sends messages of this type as latest-wins datagrams, for reports that
+  // the next one supersedes. The other end must read datagrams too. Returns
+  // false if datagrams are compiled out; such messages then stay reliable.
+  bool SendAsDatagram(unsigned char message_type);
 
  private:
+  bool IsDatagramType(unsigned char message_type) const;
+
   tensixty::RxTxPair rx_tx_;
+  unsigned char datagram_types_[MAX_DATAGRAM_TYPES];
+  int num_datagram_types_;
 };
 }  // namespace markbot
 
@@ -0,0 +1,155 @@
+#include "sync_scanner.h"
+#include "checksum.h"
+#include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define TENSIXTY_SYNC_SCANNER_X86
+#endif
+
+namespace tensixty {
+namespace {
+
+// Format bytes match FRAME_FORMAT_BASE once the low two bits are masked off.
+const unsigned char FORMAT_MASK = 0xfc;
+const size_t BASIC_HEADER_SIZE = 7;
+const size_t EXTENDED_HEADER_SIZE = 10;
+const size_t ACK_FRAME_SIZE = 5;
+const size_t EXTENDED_ACK_FRAME_SIZE = 7;
+
+bool IsFormatByte(const unsigned char c) {
+  return (c & FORMAT_MASK) == FRAME_FORMAT_BASE;
+}
+
+// Portable scan, also used for the tail of the vector scans.
+const unsigned char* FindSyncWordScalar(const unsigned char *buf, const size_t length) {
+  const unsigned char *end = buf + length;
+  while (buf < end) {
+    buf = static_cast<const unsigned char*>(memchr(buf, FRAME_START_BYTE, end - buf));
+    if (buf == nullptr) return end;
+    if (buf + 1 == end || IsFormatByte(buf[1])) return buf;
+    ++buf;
+  }
+  return end;
+}
+
+#ifdef TENSIXTY_SYNC_SCANNER_X86
+// Compares 16 bytes at a time against the start byte and the masked format
+// byte, offset by one.
+const unsigned char* FindSyncWordSse2(const unsigned char *buf, const size_t length) {
+  const __m128i first = _mm_set1_epi8(FRAME_START_BYTE);
+  const __m128i second = _mm_set1_epi8(FRAME_FORMAT_BASE);
+  const __m128i mask = _mm_set1_epi8(static_cast<char>(FORMAT_MASK));
+  size_t i = 0;
+  for (; i + 17 <= length; i += 16) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i + 1));
+    const int matches = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, first),
+                      _mm_cmpeq_epi8(_mm_and_si128(b, mask), second)));
+    if (matches != 0) return buf + i + __builtin_ctz(matches);
+  }
+  return buf + i + (FindSyncWordScalar(buf + i, length - i) - (buf + i));
+}
+
+__attribute__((target("avx2")))
+const unsigned char* FindSyncWordAvx2(const unsigned char *buf, const size_t length) {
+  const __m256i first = _mm256_set1_epi8(FRAME_START_BYTE);
+  const __m256i second = _mm256_set1_epi8(FRAME_FORMAT_BASE);
+  const __m256i mask = _mm256_set1_epi8(static_cast<char>(FORMAT_MASK));
+  size_t i = 0;
+  for (; i + 33 <= length; i += 32) {
+    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + i));
+    const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + i + 1));
+    const unsigned int matches = _mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                         _mm256_cmpeq_epi8(_mm256_and_si256(b, mask), second)));
+    if (matches != 0) return buf + i + __builtin_ctz(matches);
+  }
+  return FindSyncWordSse2(buf + i, length - i);
+}
+
+bool HasAvx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+#endif  // TENSIXTY_SYNC_SCANNER_X86
+
+bool HeaderChecksumValid(const unsigned char *header, const size_t header_size) {
+  Fletcher checksum;
+  checksum.Update(header, header_size - 2);
+  return header[header_size - 2] == checksum.first() &&
+    header[header_size - 1] == checksum.second();
+}
+
+// Bytes of the optional fields of an extended header, or -1 for unknown flags.
+int OptionalFieldsSize(const unsigned char flags) {
+  if (flags & ~(FLAGS_SACK_SIZE | FLAGS_CREDIT | FLAGS_CHANNEL | FLAGS_START)) return -1;
+  return SackBitmapSize(flags) + (flags & FLAGS_CREDIT ? 1 : 0) + (flags & FLAGS_CHANNEL ? 1 : 0);
+}
+
+}  // namespace
+
+unsigned int SackBitmapSize(const unsigned char flags) {
+  const unsigned char code = flags & FLAGS_SACK_SIZE;
+  return code == 0 ? 0 : 1 << code;
+}
+
+unsigned int FrameHeaderSize(const unsigned char *header) {
+  if (header[0] != FRAME_START_BYTE) return 0;
+  switch (header[1]) {
+    case BASIC_FRAME:
+      return BASIC_HEADER_SIZE;
+    case EXTENDED_FRAME:
+      // Unknown flags mean a format we cannot parse.
+      if (OptionalFieldsSize(header[2]) < 0) return 0;
+      return EXTENDED_HEADER_SIZE + OptionalFieldsSize(header[2]);
+    case ACK_FRAME:
+      return ACK_FRAME_SIZE;
+    case EXTENDED_ACK_FRAME:
+      if (OptionalFieldsSize(header[2]) < 0) return 0;
+      return EXTENDED_ACK_FRAME_SIZE + OptionalFieldsSize(header[2]);
+  }
+  return 0;
+}
+
+unsigned int FrameSize(const unsigned char *header) {
+  const unsigned int header_size = FrameHeaderSize(header);
+  if (header[1] == ACK_FRAME || header[1] == EXTENDED_ACK_FRAME) return header_size;
+  // The length is always the last byte before the header checksum.
+  return header_size + header[header_size - 3] + 2;
+}
+
+unsigned int FrameChannel(const unsigned char *header) {
+  if (header[1] != EXTENDED_FRAME && header[1] != EXTENDED_ACK_FRAME) return 0;
+  if (!(header[2] & FLAGS_CHANNEL)) return 0;
+  // The channel is the last optional field, before the length if any and
+  // the header checksum.
+  return header[FrameHeaderSize(header) - (header[1] == EXTENDED_FRAME ? 4 : 3)];
+}
+
+const unsigned char* FindSyncWord(const unsigned char *buf, const size_t length) {
+#ifdef TENSIXTY_SYNC_SCANNER_X86
+  if (HasAvx2()) return FindSyncWordAvx2(buf, length);
+  return FindSyncWordSse2(buf, length);
+#else
+  return FindSyncWordScalar(buf, length);
+#endif
+}
+
+const unsigned char* FindFrameStart(const unsigned char *buf, const size_t length) {
+  const unsigned char *end = buf + length;
+  while (buf < end) {
+    buf = FindSyncWord(buf, end - buf);
+    // Three bytes are enough to know the header size.
+    if (end - buf < 3) return buf;
+    const unsigned int header_size = FrameHeaderSize(buf);
+    if (header_size != 0 &&
+        (end - buf < static_cast<ptrdiff_t>(header_size) || HeaderChecksumValid(buf, header_size))) {
+      return buf;
+    }
+    ++buf;
+  }
+  return end;
+}
+
+}  // namespace tensixty
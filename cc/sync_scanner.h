@@ -0,0 +1,52 @@
+#ifndef TENSIXTY_SYNC_SCANNER_H_
+#define TENSIXTY_SYNC_SCANNER_H_
+
+#include <stddef.h>
+
+namespace tensixty {
+
+// Every frame starts with FRAME_START_BYTE. The second byte names the frame
+// format, and is always within the four values from FRAME_FORMAT_BASE.
+const unsigned char FRAME_START_BYTE = 10;
+const unsigned char FRAME_FORMAT_BASE = 60;
+const unsigned char BASIC_FRAME = 60;
+const unsigned char EXTENDED_FRAME = 61;
+// Compact ack-only frames, with a basic or an extended ack. They end with the
+// header checksum: there is no length, payload or payload checksum.
+const unsigned char ACK_FRAME = 62;
+const unsigned char EXTENDED_ACK_FRAME = 63;
+
+// Flags byte of the extended header. The low two bits give the size of the
+// selective ack bitmap that follows the index: none, 2, 4 or 8 bytes. The next
+// bits add a receive window credit byte after the bitmap, then a channel
+// byte, and mark a start sequence on a channel other than 0.
+const unsigned char FLAGS_SACK_SIZE = 0x03;
+const unsigned char FLAGS_CREDIT = 0x04;
+const unsigned char FLAGS_CHANNEL = 0x08;
+const unsigned char FLAGS_START = 0x10;
+
+// Returns the selective ack bitmap size for the given flags.
+unsigned int SackBitmapSize(unsigned char flags);
+
+// Returns the header length of the frame whose first three bytes are at
+// header, or 0 if they do not start a frame of a known format. For compact
+// ack frames, the header is the whole frame.
+unsigned int FrameHeaderSize(const unsigned char *header);
+
+// Given a complete header, returns the length of the whole frame, and the
+// logical channel it belongs to.
+unsigned int FrameSize(const unsigned char *header);
+unsigned int FrameChannel(const unsigned char *header);
+
+// Returns the first position in buf that holds a start byte followed by a
+// format byte. A 10 in the last byte also counts, since the format byte may
+// arrive with the next read. Returns buf + length if there is no such position.
+const unsigned char* FindSyncWord(const unsigned char *buf, size_t length);
+
+// Like FindSyncWord, but skips start bytes whose header is complete within buf
+// and fails its checksum, since no frame can start there.
+const unsigned char* FindFrameStart(const unsigned char *buf, size_t length);
+
+}  // namespace tensixty
+
+#endif  // TENSIXTY_SYNC_SCANNER_H_
@@ -0,0 +1,91 @@
+#include "trace.h"
+
+#if TENSIXTY_TRACE_LEVEL > 0
+
+#if !defined(__AVR__)
+#include <stdio.h>
+#endif
+
+namespace tensixty {
+namespace {
+
+static_assert((TENSIXTY_TRACE_BUFFER_SIZE & (TENSIXTY_TRACE_BUFFER_SIZE - 1)) == 0,
+    "TENSIXTY_TRACE_BUFFER_SIZE must be a power of two");
+
+TraceRecord records[TENSIXTY_TRACE_BUFFER_SIZE];
+// Total records ever written; the next slot is this modulo the buffer size.
+unsigned int next_record = 0;
+
+}  // namespace
+
+void Trace(const uint8_t event, const int16_t arg0, const int16_t arg1, const int16_t arg2) {
+  const unsigned int slot =
+    __atomic_fetch_add(&next_record, 1, __ATOMIC_RELAXED) & (TENSIXTY_TRACE_BUFFER_SIZE - 1);
+  TraceRecord &record = records[slot];
+  record.event = event;
+  record.args[0] = arg0;
+  record.args[1] = arg1;
+  record.args[2] = arg2;
+}
+
+unsigned int CopyTrace(TraceRecord *out, const unsigned int max_records) {
+  const unsigned int end = __atomic_load_n(&next_record, __ATOMIC_RELAXED);
+  unsigned int count = end < TENSIXTY_TRACE_BUFFER_SIZE ? end : TENSIXTY_TRACE_BUFFER_SIZE;
+  if (count > max_records) count = max_records;
+  for (unsigned int i = 0; i < count; ++i) {
+    out[i] = records[(end - count + i) & (TENSIXTY_TRACE_BUFFER_SIZE - 1)];
+  }
+  return count;
+}
+
+void ClearTrace() {
+  __atomic_store_n(&next_record, 0, __ATOMIC_RELAXED);
+}
+
+#if !defined(__AVR__)
+const char* TraceEventName(const uint8_t event) {
+  switch (event) {
+    case TRACE_PACKET_PARSED: return "packet parsed";
+    case TRACE_HEADER_CHECKSUM_ERROR: return "header checksum error";
+    case TRACE_DATA_CHECKSUM_ERROR: return "data checksum error";
+    case TRACE_READER_WAITING_INCOMING_ACK: return "reader waiting on incoming ack";
+    case TRACE_READER_WAITING_OUTGOING_ACK: return "reader waiting on outgoing ack";
+    case TRACE_READER_BUFFER_FULL: return "reader buffer full";
+    case TRACE_READER_OUTGOING_ACK: return "reader outgoing ack";
+    case TRACE_READER_NOT_INITIALIZED: return "reader not initialized";
+    case TRACE_READER_SEQUENCE_STARTED: return "reader sequence started";
+    case TRACE_READER_BROKEN_HEADER: return "reader broken header";
+    case TRACE_READER_DATAGRAM: return "reader datagram";
+    case TRACE_BUFFER_DROP_DUPLICATE: return "buffer drop duplicate";
+    case TRACE_BUFFER_MARK_RESEND: return "buffer mark resend";
+    case TRACE_BUFFER_RESEND: return "buffer resend";
+    case TRACE_BUFFER_REMOVED: return "buffer removed";
+    case TRACE_BUFFER_MISORDERED: return "buffer misordered";
+    case TRACE_WRITER_QUEUED: return "writer queued";
+    case TRACE_WRITER_SUPERSEDED: return "writer superseded";
+    case TRACE_WRITER_GOT_ACK: return "writer got ack";
+    case TRACE_WRITER_SEQUENCE_STARTED: return "writer sequence started";
+    case TRACE_WRITER_SEND: return "writer send";
+    case TRACE_WRITER_SEND_ACK_ONLY: return "writer send ack only";
+    case TRACE_WRITER_TIMEOUT: return "writer timeout";
+    case TRACE_WRITER_CREDIT_PROBE: return "writer credit probe";
+    case TRACE_WRITER_SEND_DATAGRAM: return "writer send datagram";
+    case TRACE_MOTOR_SPEED: return "motor speed";
+    case TRACE_MESSAGE: return "message";
+  }
+  return "unknown";
+}
+
+void DumpTrace() {
+  TraceRecord dump[TENSIXTY_TRACE_BUFFER_SIZE];
+  const unsigned int count = CopyTrace(dump, TENSIXTY_TRACE_BUFFER_SIZE);
+  for (unsigned int i = 0; i < count; ++i) {
+    printf("%s: %d %d %d\n", TraceEventName(dump[i].event),
+        dump[i].args[0], dump[i].args[1], dump[i].args[2]);
+  }
+}
+#endif  // !__AVR__
+
+}  // namespace tensixty
+
+#endif  // TENSIXTY_TRACE_LEVEL > 0
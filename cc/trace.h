@@ -0,0 +1,121 @@
+#ifndef TENSIXTY_TRACE_H_
+#define TENSIXTY_TRACE_H_
+
+// Binary event tracing for the hot paths. Events are an id plus up to three
+// small integer arguments, stored in a fixed ring buffer that can be dumped
+// later, so nothing is formatted while the link is running.
+//
+// Tracing is compiled in only when TENSIXTY_TRACE_LEVEL is defined above
+// zero, e.g. -DTENSIXTY_TRACE_LEVEL=2. Otherwise TENSIXTY_TRACE expands to
+// nothing and the ring buffer is not built. TENSIXTY_TRACE_CATEGORIES masks
+// which categories are kept, and defaults to all of them.
+
+#include <stdint.h>
+
+#ifndef TENSIXTY_TRACE_LEVEL
+#define TENSIXTY_TRACE_LEVEL 0
+#endif
+
+#ifndef TENSIXTY_TRACE_CATEGORIES
+#define TENSIXTY_TRACE_CATEGORIES 0xff
+#endif
+
+// Number of records kept. Must be a power of two.
+#ifndef TENSIXTY_TRACE_BUFFER_SIZE
+#if defined(__AVR__)
+#define TENSIXTY_TRACE_BUFFER_SIZE 16
+#else
+#define TENSIXTY_TRACE_BUFFER_SIZE 1024
+#endif
+#endif
+
+// Levels.
+#define TRACE_ERROR 1
+#define TRACE_INFO 2
+#define TRACE_DEBUG 3
+
+// Categories.
+#define TRACE_PACKET 0x01
+#define TRACE_READER 0x02
+#define TRACE_WRITER 0x04
+#define TRACE_BUFFER 0x08
+#define TRACE_MOTOR 0x10
+#define TRACE_DISPATCH 0x20
+
+namespace tensixty {
+
+enum TraceEvent {
+  // Packet parsing.
+  TRACE_PACKET_PARSED = 1,  // index, length, ack
+  TRACE_HEADER_CHECKSUM_ERROR,  // expected, actual
+  TRACE_DATA_CHECKSUM_ERROR,  // expected, actual
+  // Reader.
+  TRACE_READER_WAITING_INCOMING_ACK,  // name
+  TRACE_READER_WAITING_OUTGOING_ACK,  // name
+  TRACE_READER_BUFFER_FULL,  // name
+  TRACE_READER_OUTGOING_ACK,  // name, ack
+  TRACE_READER_NOT_INITIALIZED,  // name
+  TRACE_READER_SEQUENCE_STARTED,  // name
+  TRACE_READER_BROKEN_HEADER,  // name
+  TRACE_READER_DATAGRAM,  // name, length, dropped
+  // Buffers.
+  TRACE_BUFFER_DROP_DUPLICATE,  // index
+  TRACE_BUFFER_MARK_RESEND,  // name, index
+  TRACE_BUFFER_RESEND,  // name, index, times sent
+  TRACE_BUFFER_REMOVED,  // name, index, removed
+  TRACE_BUFFER_MISORDERED,  // name, index
+  // Writer.
+  TRACE_WRITER_QUEUED,  // name, index
+  TRACE_WRITER_SUPERSEDED,  // name, index
+  TRACE_WRITER_GOT_ACK,  // name, index, error
+  TRACE_WRITER_SEQUENCE_STARTED,  // name
+  TRACE_WRITER_SEND,  // name, index, ack
+  TRACE_WRITER_SEND_ACK_ONLY,  // name, ack
+  TRACE_WRITER_TIMEOUT,  // name, backed off timeout in ms
+  TRACE_WRITER_CREDIT_PROBE,  // name
+  TRACE_WRITER_SEND_DATAGRAM,  // name, length
+  // Motors and modules.
+  TRACE_MOTOR_SPEED,  // address, steps per tick * 10000
+  TRACE_MESSAGE,  // type, length
+};
+
+struct TraceRecord {
+  uint8_t event;
+  int16_t args[3];
+};
+
+#if TENSIXTY_TRACE_LEVEL > 0
+
+// Appends a record. Safe to call from interrupt handlers; slots are claimed
+// with an atomic increment, so no lock is ever taken.
+void Trace(uint8_t event, int16_t arg0, int16_t arg1, int16_t arg2);
+
+// Copies out up to max_records of the most recent records, oldest first, and
+// returns how many were copied.
+unsigned int CopyTrace(TraceRecord *records, unsigned int max_records);
+// Forgets all records.
+void ClearTrace();
+
+#if !defined(__AVR__)
+// Name of an event, for dumps.
+const char* TraceEventName(uint8_t event);
+// Prints all records, oldest first, to stdout.
+void DumpTrace();
+#endif
+
+#define TENSIXTY_TRACE(level, category, event, arg0, arg1, arg2) \
+  do { \
+    if ((level) <= TENSIXTY_TRACE_LEVEL && ((category) & TENSIXTY_TRACE_CATEGORIES)) { \
+      ::tensixty::Trace((event), (arg0), (arg1), (arg2)); \
+    } \
+  } while (0)
+
+#else
+
+#define TENSIXTY_TRACE(level, category, event, arg0, arg1, arg2) do {} while (0)
+
+#endif  // TENSIXTY_TRACE_LEVEL > 0
+
+}  // namespace tensixty
+
+#endif  // TENSIXTY_TRACE_H_
@@ -1,5 +1,6 @@
 #include "tests/arduino_simulator.h"
 #include "cc/commlink.h"
+#include "cc/host_loop.h"
 #include <cstring>
 #include <stdlib.h>
 #include <stdio.h>
@@ -61,6 +62,8 @@ bool ReadFile(FILE *f, unsigned char *byte) {
 int main(int argc, char **argv) {
   // arg1 = incoming serial file.
   // arg2 = outgoing serial file.
+  // arg6 (optional) = message types, separated by commas, whose queued and
+  // unsent messages a newer one of the same type replaces.
   printf("Commlink main running.\n");
   if (argc < 4) {
     printf("Call with args:\nbidir_serial_main <incoming serial filename> <outgoing serial filename> <address>");
@@ -70,6 +73,14 @@ int main(int argc, char **argv) {
   fake_arduino.UseFiles(argv[4], argv[5]);
   const int address = atoi(argv[3]);
   tensixty::RxTxPair rx_tx_pair(address, *tensixty::GetRealClock(), &fake_arduino);
+  bool supersede[256] = {false};
+  for (const char *types = argc > 6 ? argv[6] : ""; *types != '\0';) {
+    char *end;
+    const long type = strtol(types, &end, 10);
+    if (end == types) break;
+    if (type >= 0 && type < 256) supersede[type] = true;
+    types = *end == ',' ? end + 1 : end;
+  }
   DelimitParser parser;
   FILE* python_to_cc_file = fopen(argv[1], "rb+");
   FILE* cc_to_python_file = fopen(argv[2], "wb+");
@@ -88,6 +99,8 @@ int main(int argc, char **argv) {
       last_print_time = clock.micros();
     }
     fflush(stdout);
+    // Sleeps until the link has work, checking the files every ms.
+    tensixty::WaitForWork(&rx_tx_pair, clock, fileno(python_to_cc_file), 1000);
     rx_tx_pair.Tick();
     if (!rx_tx_pair.Initialized()) continue;
     if (init_time == 0) {
@@ -103,6 +116,10 @@ int main(int argc, char **argv) {
       WriteToFile(cc_to_python_file, incoming, length);
       file_write_time += clock.micros() - start_time;
     }
+    // Datagrams reach python like any other message.
+    while ((incoming = rx_tx_pair.ReceiveDatagram(&length)) != nullptr) {
+      WriteToFile(cc_to_python_file, incoming, length);
+    }
     while (true) {
       start_time = clock.micros();
       unsigned char byte;
@@ -114,7 +131,8 @@ int main(int argc, char **argv) {
       int length;
       const unsigned char *msg = parser.Consume(byte, &length);
       if (length > 0) {
-        rx_tx_pair.Transmit(msg, length);
+        rx_tx_pair.Transmit(msg, length,
+            supersede[msg[0]] ? msg[0] : tensixty::NO_SUPERSEDE_KEY);
       }
       tx_time += clock.micros() - start_time;
     }
@@ -40,8 +40,11 @@ class DelimitParser(object):
 
 # Talks to a c++ subprocess via files. Messages are delimited via newline
 # characters. Any existing newline characters are delimited with a '\' character.
+# A message whose type is in supersede_types replaces one of the same type
+# that is still queued and unsent, so only the latest command is delivered.
 class TensixtyConnection(Thread):
-    def __init__(self, device_name='0', fake_arduino_file_a=None, fake_arduino_file_b=None):
+    def __init__(self, device_name='0', fake_arduino_file_a=None, fake_arduino_file_b=None,
+                 supersede_types=()):
         Thread.__init__(self)
         randnum = str(random.getrandbits(128))
         outgoing_filename = '/tmp/tensixty_python_to_cc_' + randnum
@@ -64,6 +67,7 @@ class TensixtyConnection(Thread):
             fake_arduino_file_a,
             # Outgoing
             fake_arduino_file_b,
+            ','.join(str(t) for t in supersede_types),
             ],
             stdout=sys.stdout,#self.stdout,
             )
@@ -93,25 +97,25 @@ class TensixtyConnection(Thread):
     def _ReadMessage(self):
         parser = DelimitParser()
         while True:
-            next_int = self._ReadInt()
-            if next_int is None:
+            chunk = self._ReadAvailable()
+            if not chunk:
+                # The file can't be waited on, so check back shortly.
                 time.sleep(0.001)
                 continue
-            message = parser.Consume(next_int)
-            if message is None:
-                continue
-            for prefix, cb in self.callbacks.items():
-                if message[0] == prefix:
-                    cb(message[1:])
-            continue
+            for next_int in chunk:
+                message = parser.Consume(next_int)
+                if message is None:
+                    continue
+                for prefix, cb in self.callbacks.items():
+                    if message[0] == prefix:
+                        cb(message[1:])
 
-    def _ReadInt(self):
-        result = self.incoming.read(1)
+    def _ReadAvailable(self):
+        """Returns every byte written so far, possibly none."""
+        result = self.incoming.read1(4096)
         if result == b'':
             # Avoids EOF getting set and skipping future reads.
             self.incoming.seek(self.incoming.tell())
-            return None
-        result = int.from_bytes(result, byteorder='big')
         return result
 
     def _DelimitAndSend(self, ints):
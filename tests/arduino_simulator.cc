@@ -1,6 +1,8 @@
 #include "arduino_simulator.h"
 #include <chrono>
 #include <ctime>
+#include <string.h>
+#include <sys/stat.h>
 
 namespace tensixty {
 namespace {
@@ -94,6 +96,49 @@ bool FakeArduino::available() {
   }
 }
 
+size_t FakeArduino::write(const unsigned char *buf, const size_t length) {
+  const size_t written = fwrite(buf, 1, length, outgoing_file_);
+  fflush(outgoing_file_);
+  return written;
+}
+
+size_t FakeArduino::read(unsigned char *buf, const size_t length) {
+  if (length == 0) return 0;
+  size_t num_read = 0;
+  if (next_byte_ != EOF) {
+    buf[num_read++] = next_byte_;
+    next_byte_ = EOF;
+  }
+  num_read += fread(buf + num_read, 1, length - num_read, incoming_file_);
+  if (num_read < length) {
+    clearerr(incoming_file_);
+  }
+  if (muted_) {
+    memset(buf, 0xff, num_read);
+  }
+  return num_read;
+}
+
+size_t FakeArduino::available_bytes() {
+  struct stat file_stat;
+  const long position = ftell(incoming_file_);
+  if (position < 0 || fstat(fileno(incoming_file_), &file_stat) != 0) {
+    return available() ? 1 : 0;
+  }
+  const size_t peeked = next_byte_ != EOF ? 1 : 0;
+  if (file_stat.st_size <= position) return peeked;
+  return peeked + (file_stat.st_size - position);
+}
+
+int FakeArduino::fd() {
+  struct stat file_stat;
+  if (incoming_file_ == nullptr || fstat(fileno(incoming_file_), &file_stat) != 0 ||
+      S_ISREG(file_stat.st_mode)) {
+    return -1;
+  }
+  return fileno(incoming_file_);
+}
+
 bool FakeArduino::UseFiles(const char *incoming, const char *outgoing) {
   incoming_file_ = fopen(incoming, "rb+");
   printf("Incoming serial file: %s\n", incoming);
@@ -39,6 +39,12 @@ class FakeArduino : public ArduinoInterface {
   void write(const unsigned char c) override;
   unsigned char read() override;
   bool available() override;
+  size_t write(const unsigned char *buf, size_t length) override;
+  size_t read(unsigned char *buf, size_t length) override;
+  size_t available_bytes() override;
+  // The incoming file's descriptor, unless it is a regular file, which
+  // always polls as readable.
+  int fd() override;
   void setPinModeOutput(unsigned int pin) override;
   void setPinModeInput(unsigned int pin) override;
   void setPinModePullup(unsigned int pin) override;
@@ -68,5 +68,57 @@ TEST(HardwareAbstractionTest, SerialIO) {
   EXPECT_EQ(s0.read(), 0x04);
 }
 
+TEST(HardwareAbstractionTest, BulkSerialIO) {
+  FakeArduino s0, s1;
+  ASSERT_TRUE(s0.UseFiles("/tmp/test_bulk_serial_io_a", "/tmp/test_bulk_serial_io_b"));
+  ASSERT_TRUE(s1.UseFiles("/tmp/test_bulk_serial_io_b", "/tmp/test_bulk_serial_io_a"));
+  EXPECT_EQ(s1.available_bytes(), 0u);
+  const unsigned char sent[5] = {1, 2, 3, 4, 5};
+  EXPECT_EQ(s0.write(sent, 5), 5u);
+  EXPECT_EQ(s1.available_bytes(), 5u);
+  // Peeking with available() must not lose a byte.
+  EXPECT_TRUE(s1.available());
+  EXPECT_EQ(s1.available_bytes(), 5u);
+  unsigned char received[8];
+  EXPECT_EQ(s1.read(received, 2), 2u);
+  EXPECT_EQ(received[0], 1);
+  EXPECT_EQ(received[1], 2);
+  EXPECT_EQ(s1.read(), 3);
+  EXPECT_EQ(s1.read(received, 8), 2u);
+  EXPECT_EQ(received[0], 4);
+  EXPECT_EQ(received[1], 5);
+  EXPECT_EQ(s1.read(received, 8), 0u);
+  EXPECT_EQ(s1.available_bytes(), 0u);
+  s0.write(6);
+  EXPECT_EQ(s1.read(received, 8), 1u);
+  EXPECT_EQ(received[0], 6);
+}
+
+// A backend with only the byte calls still supports the bulk calls.
+class ByteOnlySerial : public SerialInterface {
+ public:
+  void write(const unsigned char c) override { bytes_[end_++] = c; }
+  unsigned char read() override { return bytes_[start_++]; }
+  bool available() override { return start_ < end_; }
+
+ private:
+  unsigned char bytes_[16];
+  int start_ = 0;
+  int end_ = 0;
+};
+
+TEST(HardwareAbstractionTest, BulkDefaultsUseByteCalls) {
+  ByteOnlySerial serial;
+  SerialInterface *s = &serial;
+  EXPECT_EQ(s->available_bytes(), 0u);
+  const unsigned char sent[3] = {7, 8, 9};
+  EXPECT_EQ(s->write(sent, 3), 3u);
+  EXPECT_EQ(s->available_bytes(), 1u);
+  unsigned char received[8];
+  EXPECT_EQ(s->read(received, 8), 3u);
+  EXPECT_EQ(received[2], 9);
+  EXPECT_GT(s->available_for_write(), 0u);
+}
+
 }  // namespace
 }  // namespace tensixty
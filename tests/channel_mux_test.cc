@@ -0,0 +1,158 @@
+// Using https://github.com/google/googletest
+#include <gtest/gtest.h>
+#include "cc/channel_mux.h"
+#include "cc/commlink.h"
+#include "arduino_simulator.h"
+#include "memory_serial.h"
+
+namespace tensixty {
+
+namespace {
+
+LinkConfig ChannelConfig(const unsigned int channel) {
+  LinkConfig config;
+  config.window_size = 16;
+  config.cumulative_ack = true;
+  config.channel = channel;
+  return config;
+}
+
+// One end of a link carrying two channels.
+struct End {
+  End(const int name, const Clock &clock, SerialInterface *serial,
+      const unsigned int priority1 = 0, const unsigned int weight1 = 1)
+    : first(name, clock, serial, ChannelConfig(0)),
+      second(name, clock, serial, ChannelConfig(1)),
+      mux(serial) {
+    EXPECT_TRUE(mux.AddChannel(&first));
+    EXPECT_TRUE(mux.AddChannel(&second, priority1, weight1));
+  }
+  RxTxPair first;
+  RxTxPair second;
+  ChannelMux mux;
+};
+
+void Start(End *e0, End *e1, FakeClock *clock) {
+  for (int i = 0; i < 20; ++i) {
+    e0->mux.Tick();
+    e1->mux.Tick();
+    clock->IncrementTime(100);
+  }
+  EXPECT_TRUE(e0->first.Initialized());
+  EXPECT_TRUE(e0->second.Initialized());
+  EXPECT_TRUE(e1->first.Initialized());
+  EXPECT_TRUE(e1->second.Initialized());
+}
+
+// Counts messages received on pair, checking they arrive in order.
+void ReceiveAll(RxTxPair *pair, int *received) {
+  unsigned char length;
+  const unsigned char *data;
+  while ((data = pair->Receive(&length)) != nullptr) {
+    EXPECT_EQ(1, length);
+    EXPECT_EQ(*received & 0xff, data[0]);
+    ++*received;
+  }
+}
+
+TEST(ChannelMuxTest, RejectsDuplicateChannels) {
+  MemorySerial s;
+  ChannelMux mux(&s);
+  RxTxPair p0(0, *GetFakeClock(), &s, ChannelConfig(0));
+  RxTxPair p1(1, *GetFakeClock(), &s, ChannelConfig(0));
+  EXPECT_TRUE(mux.AddChannel(&p0));
+  EXPECT_FALSE(mux.AddChannel(&p1));
+}
+
+TEST(ChannelMuxTest, ChannelsKeepTheirOwnOrder) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  FakeClock *clock = GetFakeClock();
+  End e0(0, *clock, &s0);
+  End e1(1, *clock, &s1);
+  Start(&e0, &e1, clock);
+  const int num_messages = 100;
+  int sent[2] = {0, 0};
+  int received[2] = {0, 0};
+  RxTxPair *senders[2] = {&e0.first, &e1.second};
+  RxTxPair *receivers[2] = {&e1.first, &e0.second};
+  for (int ticks = 0; ticks < 10000 &&
+       (received[0] < num_messages || received[1] < num_messages); ++ticks) {
+    for (int c = 0; c < 2; ++c) {
+      const unsigned char message[1] = {static_cast<unsigned char>(sent[c])};
+      if (sent[c] < num_messages && senders[c]->Transmit(message, 1)) ++sent[c];
+    }
+    e0.mux.Tick();
+    e1.mux.Tick();
+    clock->IncrementTime(100);
+    for (int c = 0; c < 2; ++c) ReceiveAll(receivers[c], &received[c]);
+  }
+  EXPECT_EQ(num_messages, received[0]);
+  EXPECT_EQ(num_messages, received[1]);
+}
+
+TEST(ChannelMuxTest, ControlPreemptsBulk) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  FakeClock *clock = GetFakeClock();
+  // The second channel carries bulk data, behind the first.
+  End e0(0, *clock, &s0, 1);
+  End e1(1, *clock, &s1, 1);
+  Start(&e0, &e1, clock);
+  int bulk_sent = 0;
+  int bulk_received = 0;
+  int control_sent = 0;
+  int control_received = 0;
+  for (int ticks = 0; ticks < 200; ++ticks) {
+    unsigned char message[1] = {static_cast<unsigned char>(bulk_sent)};
+    while (e0.second.Transmit(message, 1)) message[0] = ++bulk_sent;
+    if (ticks >= 20 && ticks % 10 == 0) {
+      const unsigned char control[1] = {static_cast<unsigned char>(control_sent)};
+      EXPECT_TRUE(e0.first.Transmit(control, 1));
+      ++control_sent;
+    }
+    e0.mux.Tick();
+    e1.mux.Tick();
+    clock->IncrementTime(100);
+    ReceiveAll(&e1.second, &bulk_received);
+    const int before = control_received;
+    ReceiveAll(&e1.first, &control_received);
+    // Nothing ever queues on the control channel.
+    EXPECT_LE(control_sent - control_received, 1);
+    if (control_received > before) {
+      EXPECT_EQ(control_sent, control_received);
+    }
+  }
+  EXPECT_EQ(18, control_received);
+  EXPECT_GT(bulk_received, 100);
+}
+
+TEST(ChannelMuxTest, WeightsShareTheLink) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  FakeClock *clock = GetFakeClock();
+  // Both channels always have data; the second gets three times the share.
+  End e0(0, *clock, &s0, 0, 3);
+  End e1(1, *clock, &s1, 0, 3);
+  Start(&e0, &e1, clock);
+  int sent[2] = {0, 0};
+  int received[2] = {0, 0};
+  RxTxPair *senders[2] = {&e0.first, &e0.second};
+  RxTxPair *receivers[2] = {&e1.first, &e1.second};
+  for (int ticks = 0; ticks < 400; ++ticks) {
+    for (int c = 0; c < 2; ++c) {
+      unsigned char message[1] = {static_cast<unsigned char>(sent[c])};
+      while (senders[c]->Transmit(message, 1)) message[0] = ++sent[c];
+    }
+    e0.mux.Tick();
+    e1.mux.Tick();
+    clock->IncrementTime(100);
+    for (int c = 0; c < 2; ++c) ReceiveAll(receivers[c], &received[c]);
+  }
+  EXPECT_GT(received[0], 50);
+  EXPECT_NEAR(3.0, static_cast<double>(received[1]) / received[0], 0.3);
+}
+
+}  // namespace
+
+}  // namespace tensixty
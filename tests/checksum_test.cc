@@ -0,0 +1,85 @@
+// Using https://github.com/google/googletest
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include "cc/checksum.h"
+
+namespace tensixty {
+namespace {
+
+// The byte-wise checksum the protocol has always used.
+void ReferenceChecksum(const unsigned char *buf, const size_t length,
+    unsigned char *first, unsigned char *second) {
+  for (size_t i = 0; i < length; ++i) {
+    *first += buf[i];
+    *second += *first;
+  }
+}
+
+TEST(FletcherTest, Empty) {
+  Fletcher checksum;
+  checksum.Update(nullptr, 0);
+  EXPECT_EQ(checksum.first(), 0);
+  EXPECT_EQ(checksum.second(), 0);
+}
+
+TEST(FletcherTest, BlockMatchesBytewise) {
+  unsigned char buf[1024];
+  srand(1060);
+  for (int i = 0; i < 1024; ++i) {
+    buf[i] = rand();
+  }
+  for (size_t length = 0; length <= 600; ++length) {
+    const size_t offset = length % 7;
+    unsigned char first = 0, second = 0;
+    ReferenceChecksum(buf + offset, length, &first, &second);
+    Fletcher checksum;
+    checksum.Update(buf + offset, length);
+    ASSERT_EQ(checksum.first(), first) << "length " << length;
+    ASSERT_EQ(checksum.second(), second) << "length " << length;
+  }
+}
+
+TEST(FletcherTest, SaturatedBytes) {
+  // All 0xff exercises the widest intermediate sums.
+  unsigned char buf[300];
+  for (int i = 0; i < 300; ++i) {
+    buf[i] = 0xff;
+  }
+  unsigned char first = 0, second = 0;
+  ReferenceChecksum(buf, 300, &first, &second);
+  Fletcher checksum;
+  checksum.Update(buf, 300);
+  EXPECT_EQ(checksum.first(), first);
+  EXPECT_EQ(checksum.second(), second);
+}
+
+TEST(FletcherTest, IncrementalMatchesBytewise) {
+  unsigned char buf[512];
+  srand(60);
+  for (int trial = 0; trial < 500; ++trial) {
+    for (int i = 0; i < 512; ++i) {
+      buf[i] = rand();
+    }
+    unsigned char first = 0, second = 0;
+    ReferenceChecksum(buf, 512, &first, &second);
+    // Mix single-byte and block updates over random splits.
+    Fletcher checksum;
+    size_t i = 0;
+    while (i < 512) {
+      size_t length = rand() % 70;
+      if (length > 512 - i) length = 512 - i;
+      if (length == 1) {
+        checksum.Update(buf[i]);
+      } else {
+        checksum.Update(buf + i, length);
+      }
+      i += length;
+    }
+    ASSERT_EQ(checksum.first(), first) << "trial " << trial;
+    ASSERT_EQ(checksum.second(), second) << "trial " << trial;
+  }
+}
+
+}  // namespace
+}  // namespace tensixty
@@ -1,15 +1,16 @@
 #include <gtest/gtest.h>
+#include <string.h>
 #include "cc/commlink.h"
 #include "arduino_simulator.h"
+#include "memory_serial.h"
 #include "cc/serial_interface.h"
 
 namespace tensixty {
 namespace {
 
 TEST(PairTest, SendBothWays) {
-  FakeArduino s0, s1;
-  ASSERT_TRUE(s0.UseFiles("/tmp/send_bidir_a", "/tmp/send_bidir_b"));
-  ASSERT_TRUE(s1.UseFiles("/tmp/send_bidir_b", "/tmp/send_bidir_a"));
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
   RxTxPair p0(0, *GetRealClock(), &s0);
   RxTxPair p1(1, *GetRealClock(), &s1);
   p0.Tick();
@@ -80,6 +81,763 @@ TEST(PairTest, SendBothWays) {
   EXPECT_EQ(NUM_TO_SEND, p1_receive_index);
 }
 
+// Starts both ends, then fills p0's window and streams num_messages to p1.
+// Returns how many messages p0 accepted before the first tick.
+int StreamMessages(RxTxPair *p0, RxTxPair *p1, const int num_messages) {
+  for (int i = 0; i < 10 && !(p0->Initialized() && p1->Initialized()); ++i) {
+    p0->Tick();
+    p1->Tick();
+  }
+  EXPECT_TRUE(p0->Initialized());
+  EXPECT_TRUE(p1->Initialized());
+  int sent = 0;
+  int received = 0;
+  unsigned char message[2];
+  auto transmit = [&]() {
+    message[0] = sent & 0xff;
+    message[1] = sent >> 8;
+    if (sent < num_messages && p0->Transmit(message, 2)) {
+      ++sent;
+      return true;
+    }
+    return false;
+  };
+  while (transmit());
+  const int window = sent;
+  for (int ticks = 0; received < num_messages && ticks < 100 * num_messages; ++ticks) {
+    p0->Tick();
+    p1->Tick();
+    while (transmit());
+    unsigned char length;
+    const unsigned char *data;
+    while ((data = p1->Receive(&length)) != nullptr) {
+      EXPECT_EQ(2, length);
+      EXPECT_EQ(received, data[0] | (data[1] << 8));
+      ++received;
+    }
+  }
+  EXPECT_EQ(num_messages, received);
+  return window;
+}
+
+TEST(PairTest, ExtendedHeaderWideWindow) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  LinkConfig config;
+  config.window_size = 48;
+  config.extended_header = true;
+  RxTxPair p0(0, *GetRealClock(), &s0, config);
+  RxTxPair p1(1, *GetRealClock(), &s1, config);
+  // Past the basic index space, so the 15-bit indices are exercised.
+  EXPECT_EQ(48, StreamMessages(&p0, &p1, 600));
+}
+
+TEST(PairTest, ExtendedHeaderNeedsBothEnds) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  LinkConfig config;
+  config.window_size = 48;
+  config.extended_header = true;
+  LinkConfig basic_config;
+  basic_config.window_size = 48;
+  RxTxPair p0(0, *GetRealClock(), &s0, config);
+  RxTxPair p1(1, *GetRealClock(), &s1, basic_config);
+  // Basic headers limit the window to a quarter of the 7-bit index space.
+  EXPECT_EQ(31, StreamMessages(&p0, &p1, 300));
+}
+
+TEST(PairTest, WindowIsTheSmallerOfBothEnds) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  LinkConfig config;
+  config.window_size = 16;
+  RxTxPair p0(0, *GetRealClock(), &s0, config);
+  RxTxPair p1(1, *GetRealClock(), &s1);
+  EXPECT_EQ(DEFAULT_WINDOW_SIZE, StreamMessages(&p0, &p1, 50));
+}
+
+// Drops every drop_period-th frame written, if drop_period is nonzero, and
+// counts the bytes that made it.
+class LossySerial : public SerialInterface {
+ public:
+  LossySerial(SerialInterface *serial, const int drop_period)
+    : serial_(serial), drop_period_(drop_period) {}
+
+  void write(const unsigned char c) override { serial_->write(c); }
+  unsigned char read() override { return serial_->read(); }
+  bool available() override { return serial_->available(); }
+  size_t write(const unsigned char *buf, size_t length) override {
+    ++frames_;
+    if (drop_next_ || (drop_period_ != 0 && frames_ % drop_period_ == 0)) {
+      drop_next_ = false;
+      return length;
+    }
+    bytes_written_ += length;
+    return serial_->write(buf, length);
+  }
+  size_t read(unsigned char *buf, size_t length) override {
+    return serial_->read(buf, length);
+  }
+  size_t available_bytes() override { return serial_->available_bytes(); }
+  size_t available_for_write() override { return tx_space_; }
+
+  int bytes_written() const { return bytes_written_; }
+  int frames() const { return frames_; }
+  // Room reported for writes without waiting.
+  void SetTxSpace(const size_t tx_space) { tx_space_ = tx_space; }
+  void DropNextFrame() { drop_next_ = true; }
+
+ private:
+  SerialInterface *serial_;
+  const int drop_period_;
+  int frames_ = 0;
+  int bytes_written_ = 0;
+  bool drop_next_ = false;
+  size_t tx_space_ = static_cast<size_t>(-1);
+};
+
+// Streams num_messages from p0 to p1 over a link that loses every 7th frame
+// in that direction, and returns the bytes p0 wrote.
+int StreamOverLossyLink(const LinkConfig &config, const int num_messages) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  LossySerial lossy(&s0, 7);
+  FakeClock *clock = GetFakeClock();
+  RxTxPair p0(0, *clock, &lossy, config);
+  RxTxPair p1(1, *clock, &s1, config);
+  for (int i = 0; i < 20 && !(p0.Initialized() && p1.Initialized()); ++i) {
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(1000);
+  }
+  EXPECT_TRUE(p0.Initialized());
+  EXPECT_TRUE(p1.Initialized());
+  int sent = 0;
+  int received = 0;
+  unsigned char message[2];
+  for (int ticks = 0; received < num_messages && ticks < 100 * num_messages;
+       ++ticks) {
+    message[0] = sent & 0xff;
+    message[1] = sent >> 8;
+    while (sent < num_messages && p0.Transmit(message, 2)) {
+      ++sent;
+      message[0] = sent & 0xff;
+      message[1] = sent >> 8;
+    }
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(1000);
+    unsigned char length;
+    const unsigned char *data;
+    while ((data = p1.Receive(&length)) != nullptr) {
+      EXPECT_EQ(2, length);
+      EXPECT_EQ(received, data[0] | (data[1] << 8));
+      ++received;
+    }
+  }
+  EXPECT_EQ(num_messages, received);
+  return lossy.bytes_written();
+}
+
+TEST(PairTest, SelectiveAckResendsLess) {
+  LinkConfig config;
+  config.window_size = 16;
+  config.extended_header = true;
+  const int cumulative_bytes = StreamOverLossyLink(config, 300);
+  config.selective_ack = true;
+  const int selective_bytes = StreamOverLossyLink(config, 300);
+  EXPECT_LT(selective_bytes, cumulative_bytes);
+}
+
+TEST(PairTest, TimeoutFollowsRoundTrip) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  FakeClock *clock = GetFakeClock();
+  RxTxPair p0(0, *clock, &s0);
+  RxTxPair p1(1, *clock, &s1);
+  EXPECT_FALSE(p0.rtt_estimator().has_sample());
+  EXPECT_EQ(100000, p0.rtt_estimator().rto());
+  const unsigned char message[1] = {7};
+  for (int i = 0; i < 200; ++i) {
+    p0.Transmit(message, 1);
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(1000);
+    unsigned char length;
+    while (p1.Receive(&length) != nullptr);
+  }
+  // Each packet is acked within a couple of 1 ms ticks.
+  EXPECT_TRUE(p0.rtt_estimator().has_sample());
+  EXPECT_GE(p0.rtt_estimator().smoothed_rtt(), 1000);
+  EXPECT_LE(p0.rtt_estimator().smoothed_rtt(), 3000);
+  EXPECT_LT(p0.rtt_estimator().rto(), 10000);
+}
+
+TEST(PairTest, LostPacketIsNotStarvedByNewSends) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  LossySerial lossy(&s0, 0);
+  FakeClock *clock = GetFakeClock();
+  LinkConfig config;
+  config.window_size = 16;
+  config.extended_header = true;
+  RxTxPair p0(0, *clock, &lossy, config);
+  RxTxPair p1(1, *clock, &s1, config);
+  for (int i = 0; i < 20 && !(p0.Initialized() && p1.Initialized()); ++i) {
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(100);
+  }
+  ASSERT_TRUE(p0.Initialized());
+  ASSERT_TRUE(p1.Initialized());
+  unsigned long deadline;
+  EXPECT_FALSE(p0.NextDeadline(&deadline));
+  unsigned char message[1] = {0};
+  ASSERT_TRUE(p0.Transmit(message, 1));
+  // The first data packet is lost, and nothing is acked until it arrives.
+  lossy.DropNextFrame();
+  p0.Tick();
+  ASSERT_TRUE(p0.NextDeadline(&deadline));
+  EXPECT_EQ(clock->micros() + p0.rtt_estimator().rto(), deadline);
+  // A new packet goes out every tick, which would hold back a writer-wide
+  // timer for as long as the window has room.
+  int first_received_tick = -1;
+  for (int tick = 1; tick < 15 && first_received_tick < 0; ++tick) {
+    clock->IncrementTime(10000);
+    ++message[0];
+    EXPECT_TRUE(p0.Transmit(message, 1));
+    p0.Tick();
+    p1.Tick();
+    unsigned char length;
+    const unsigned char *data = p1.Receive(&length);
+    if (data != nullptr) {
+      EXPECT_EQ(0, data[0]);
+      first_received_tick = tick;
+    }
+  }
+  // Resent once its own 100 ms timer ran out.
+  EXPECT_GE(first_received_tick, 10);
+  EXPECT_LE(first_received_tick, 12);
+}
+
+// Streams num_messages from p0 to p1, one per 100 us tick, and returns the
+// bytes p1 wrote back.
+int ReverseBytes(const LinkConfig &config, const int num_messages) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  LossySerial counting(&s1, 0);
+  FakeClock *clock = GetFakeClock();
+  RxTxPair p0(0, *clock, &s0, config);
+  RxTxPair p1(1, *clock, &counting, config);
+  for (int i = 0; i < 20 && !(p0.Initialized() && p1.Initialized()); ++i) {
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(100);
+  }
+  EXPECT_TRUE(p0.Initialized());
+  EXPECT_TRUE(p1.Initialized());
+  const int start_bytes = counting.bytes_written();
+  int sent = 0;
+  int received = 0;
+  for (int ticks = 0; received < num_messages && ticks < 100 * num_messages; ++ticks) {
+    const unsigned char message[1] = {static_cast<unsigned char>(sent)};
+    if (sent < num_messages && p0.Transmit(message, 1)) ++sent;
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(100);
+    unsigned char length;
+    const unsigned char *data;
+    while ((data = p1.Receive(&length)) != nullptr) {
+      EXPECT_EQ(received & 0xff, data[0]);
+      ++received;
+    }
+  }
+  EXPECT_EQ(num_messages, received);
+  return counting.bytes_written() - start_bytes;
+}
+
+TEST(PairTest, DelayedAcksCutReverseTraffic) {
+  LinkConfig config;
+  config.window_size = 8;
+  const int immediate_bytes = ReverseBytes(config, 200);
+  config.cumulative_ack = true;
+  config.ack_delay_micros = 2000;
+  config.ack_every_packets = 4;
+  const int delayed_bytes = ReverseBytes(config, 200);
+  EXPECT_LT(delayed_bytes * 3, immediate_bytes);
+}
+
+TEST(PairTest, CompactAcksCutReverseTraffic) {
+  LinkConfig config;
+  const int full_bytes = ReverseBytes(config, 100);
+  config.compact_ack = true;
+  const int compact_bytes = ReverseBytes(config, 100);
+  // Acks shrink from 9 bytes to 5.
+  EXPECT_LT(compact_bytes * 3, full_bytes * 2);
+  // From 12 bytes to 7 with the extended header.
+  config.extended_header = true;
+  config.compact_ack = false;
+  const int extended_bytes = ReverseBytes(config, 100);
+  config.compact_ack = true;
+  EXPECT_LT(ReverseBytes(config, 100) * 4, extended_bytes * 3);
+}
+
+// Bytes the sender writes while the receiver leaves its packets unread for a
+// while. All messages must still arrive, in order, once it reads again.
+int SlowReceiverBytes(const LinkConfig &config) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  LossySerial counting(&s0, 0);
+  FakeClock *clock = GetFakeClock();
+  RxTxPair p0(0, *clock, &counting, config);
+  RxTxPair p1(1, *clock, &s1, config);
+  for (int i = 0; i < 20 && !(p0.Initialized() && p1.Initialized()); ++i) {
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(100);
+  }
+  EXPECT_TRUE(p0.Initialized());
+  EXPECT_TRUE(p1.Initialized());
+  const int num_messages = 20;
+  int sent = 0;
+  int received = 0;
+  int slow_bytes = 0;
+  const int start_bytes = counting.bytes_written();
+  for (int ticks = 0; received < num_messages && ticks < 10000; ++ticks) {
+    const unsigned char message[1] = {static_cast<unsigned char>(sent)};
+    if (sent < num_messages && p0.Transmit(message, 1)) ++sent;
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(100);
+    if (ticks < 5000) continue;
+    if (ticks == 5000) slow_bytes = counting.bytes_written() - start_bytes;
+    unsigned char length;
+    const unsigned char *data;
+    while ((data = p1.Receive(&length)) != nullptr) {
+      EXPECT_EQ(received, data[0]);
+      ++received;
+    }
+  }
+  EXPECT_EQ(num_messages, received);
+  return slow_bytes;
+}
+
+TEST(PairTest, CreditStopsResendsToSlowReceiver) {
+  LinkConfig config;
+  config.extended_header = true;
+  config.initial_rto_micros = 5000;
+  config.max_rto_micros = 20000;
+  const int resend_bytes = SlowReceiverBytes(config);
+  config.credit = true;
+  const int credit_bytes = SlowReceiverBytes(config);
+  // Each timeout resends the whole window, where credit sends one probe.
+  EXPECT_LT(credit_bytes * 2, resend_bytes);
+}
+
+TEST(PairTest, CreditOverLossyLinks) {
+  LinkConfig config;
+  config.window_size = 16;
+  config.extended_header = true;
+  config.selective_ack = true;
+  config.credit = true;
+  StreamOverLossyLink(config, 300);
+
+  // A slow receiver whose acks, and so its credit, are often lost.
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  LossySerial lossy(&s1, 3);
+  FakeClock *clock = GetFakeClock();
+  RxTxPair p0(0, *clock, &s0, config);
+  RxTxPair p1(1, *clock, &lossy, config);
+  const int num_messages = 100;
+  int sent = 0;
+  int received = 0;
+  for (int ticks = 0; received < num_messages && ticks < 100000; ++ticks) {
+    const unsigned char message[1] = {static_cast<unsigned char>(sent)};
+    if (sent < num_messages && p0.Transmit(message, 1)) ++sent;
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(100);
+    unsigned char length;
+    const unsigned char *data;
+    if (ticks % 20 == 0 && (data = p1.Receive(&length)) != nullptr) {
+      EXPECT_EQ(received, data[0]);
+      ++received;
+    }
+  }
+  EXPECT_EQ(num_messages, received);
+}
+
+TEST(PairTest, CumulativeAcksGoQuiet) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  LossySerial counting0(&s0, 0);
+  LossySerial counting1(&s1, 0);
+  FakeClock *clock = GetFakeClock();
+  LinkConfig config;
+  config.cumulative_ack = true;
+  RxTxPair p0(0, *clock, &counting0, config);
+  RxTxPair p1(1, *clock, &counting1, config);
+  // Data both ways, so both ends have acks to send.
+  const unsigned char message[1] = {1};
+  auto tick = [&](const bool transmit) {
+    if (transmit) {
+      p0.Transmit(message, 1);
+      p1.Transmit(message, 1);
+    }
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(100);
+    unsigned char length;
+    while (p0.Receive(&length) != nullptr);
+    while (p1.Receive(&length) != nullptr);
+  };
+  for (int i = 0; i < 20; ++i) tick(true);
+  for (int i = 0; i < 10; ++i) tick(false);
+  // Ack-only frames are not acked in turn.
+  const int bytes0 = counting0.bytes_written();
+  const int bytes1 = counting1.bytes_written();
+  for (int i = 0; i < 100; ++i) tick(false);
+  EXPECT_EQ(bytes0, counting0.bytes_written());
+  EXPECT_EQ(bytes1, counting1.bytes_written());
+}
+
+// Starts both ends on the fake clock.
+void StartPair(RxTxPair *p0, RxTxPair *p1, FakeClock *clock) {
+  for (int i = 0; i < 20 && !(p0->Initialized() && p1->Initialized()); ++i) {
+    p0->Tick();
+    p1->Tick();
+    clock->IncrementTime(100);
+  }
+  EXPECT_TRUE(p0->Initialized());
+  EXPECT_TRUE(p1->Initialized());
+}
+
+TEST(PairTest, DatagramsAreNeverResent) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  LossySerial lossy(&s0, 4);
+  FakeClock *clock = GetFakeClock();
+  LinkConfig config;
+  config.window_size = 16;
+  config.extended_header = true;
+  config.selective_ack = true;
+  config.initial_rto_micros = 5000;
+  RxTxPair p0(0, *clock, &lossy, config);
+  RxTxPair p1(1, *clock, &s1, config);
+  const unsigned char report[2] = {0x96, 0};
+  EXPECT_FALSE(p0.TransmitDatagram(report, 2));
+  StartPair(&p0, &p1, clock);
+
+  // Reliable data and datagrams side by side, over a link losing every 4th
+  // frame.
+  const int num_messages = 40;
+  int sent = 0;
+  int received = 0;
+  int datagrams_sent = 0;
+  int datagrams_received = 0;
+  int last_datagram = -1;
+  for (int ticks = 0; ticks < 2000; ++ticks) {
+    const unsigned char message[1] = {static_cast<unsigned char>(sent)};
+    if (sent < num_messages && p0.Transmit(message, 1)) ++sent;
+    if (ticks % 5 == 0 && datagrams_sent < 100) {
+      const unsigned char sample[2] = {0x96, static_cast<unsigned char>(datagrams_sent)};
+      EXPECT_TRUE(p0.TransmitDatagram(sample, 2));
+      ++datagrams_sent;
+    }
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(1000);
+    unsigned char length;
+    const unsigned char *data;
+    while ((data = p1.Receive(&length)) != nullptr) {
+      EXPECT_EQ(received, data[0]);
+      ++received;
+    }
+    while ((data = p1.ReceiveDatagram(&length)) != nullptr) {
+      ASSERT_EQ(2, length);
+      EXPECT_EQ(0x96, data[0]);
+      // Never repeated or reordered.
+      EXPECT_GT(data[1], last_datagram);
+      last_datagram = data[1];
+      ++datagrams_received;
+    }
+  }
+  EXPECT_EQ(num_messages, received);
+  EXPECT_EQ(100, datagrams_sent);
+  // Some were lost, and none came back.
+  EXPECT_LT(datagrams_received, datagrams_sent);
+  EXPECT_GT(datagrams_received, datagrams_sent / 2);
+}
+
+TEST(PairTest, LatestDatagramWins) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  FakeClock *clock = GetFakeClock();
+  LinkConfig config;
+  config.extended_header = true;
+  RxTxPair p0(0, *clock, &s0, config);
+  RxTxPair p1(1, *clock, &s1, config);
+  StartPair(&p0, &p1, clock);
+
+  // Three samples of one type and one of another, before any goes out.
+  for (unsigned char i = 1; i <= 3; ++i) {
+    const unsigned char sample[3] = {0x95, i, i};
+    EXPECT_TRUE(p0.TransmitDatagram(sample, 3, true));
+  }
+  const unsigned char other[1] = {0x96};
+  EXPECT_TRUE(p0.TransmitDatagram(other, 1, true));
+  for (int i = 0; i < 5; ++i) {
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(100);
+  }
+  unsigned char length;
+  const unsigned char *data = p1.ReceiveDatagram(&length);
+  ASSERT_NE(nullptr, data);
+  ASSERT_EQ(3, length);
+  EXPECT_EQ(0x95, data[0]);
+  EXPECT_EQ(3, data[1]);
+  data = p1.ReceiveDatagram(&length);
+  ASSERT_NE(nullptr, data);
+  ASSERT_EQ(1, length);
+  EXPECT_EQ(0x96, data[0]);
+  EXPECT_EQ(nullptr, p1.ReceiveDatagram(&length));
+
+  // Without latest_wins they queue, up to the limit.
+  for (unsigned int i = 0; i < MAX_DATAGRAMS; ++i) {
+    EXPECT_TRUE(p0.TransmitDatagram(other, 1));
+  }
+  EXPECT_FALSE(p0.TransmitDatagram(other, 1));
+}
+
+TEST(PairTest, DatagramKeepsQueuedDataAck) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  FakeClock *clock = GetFakeClock();
+  RxTxPair p0(0, *clock, &s0);
+  RxTxPair p1(1, *clock, &s1);
+  StartPair(&p0, &p1, clock);
+  p0.Tick();
+  p1.Tick();
+  const unsigned char message[1] = {4};
+  ASSERT_TRUE(p0.Transmit(message, 1));
+  p0.Tick();
+  p1.Tick();
+  // The ack for the message is queued when it is popped, and a datagram
+  // arrives before p1 writes again.
+  unsigned char length;
+  ASSERT_NE(nullptr, p1.Receive(&length));
+  const unsigned char sample[1] = {0x96};
+  ASSERT_TRUE(p0.TransmitDatagram(sample, 1));
+  p0.Tick();
+  p1.Tick();
+  ASSERT_NE(nullptr, p1.ReceiveDatagram(&length));
+  // The ack still goes out, so p0 has nothing left to resend.
+  p0.Tick();
+  unsigned long deadline;
+  EXPECT_FALSE(p0.NextDeadline(&deadline));
+}
+
+// Bytes p0 writes to deliver num_messages small messages, a few per tick.
+int BatchedBytes(const LinkConfig &config, const int num_messages) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  LossySerial counting(&s0, 0);
+  FakeClock *clock = GetFakeClock();
+  RxTxPair p0(0, *clock, &counting, config);
+  RxTxPair p1(1, *clock, &s1, config);
+  StartPair(&p0, &p1, clock);
+  const int start_bytes = counting.bytes_written();
+  int sent = 0;
+  int received = 0;
+  for (int ticks = 0; received < num_messages && ticks < 1000; ++ticks) {
+    for (int i = 0; i < 4 && sent < num_messages; ++i) {
+      const unsigned char message[3] = {static_cast<unsigned char>(sent), 1, 2};
+      if (!p0.Transmit(message, 3)) break;
+      ++sent;
+    }
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(100);
+    unsigned char length;
+    const unsigned char *data;
+    while ((data = p1.Receive(&length)) != nullptr) {
+      EXPECT_EQ(3, length);
+      EXPECT_EQ(received & 0xff, data[0]);
+      ++received;
+    }
+  }
+  EXPECT_EQ(num_messages, received);
+  return counting.bytes_written() - start_bytes;
+}
+
+TEST(PairTest, BatchingSharesFrames) {
+  LinkConfig config;
+  config.window_size = 8;
+  config.cumulative_ack = true;
+  const int unbatched_bytes = BatchedBytes(config, 200);
+  config.batch = true;
+  const int batched_bytes = BatchedBytes(config, 200);
+  // Four messages share each frame header and checksums.
+  EXPECT_LT(batched_bytes * 3, unbatched_bytes * 2);
+}
+
+TEST(PairTest, BatchWaitsForDelayOrFlush) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  FakeClock *clock = GetFakeClock();
+  LinkConfig config;
+  config.batch = true;
+  config.batch_delay_micros = 1000;
+  RxTxPair p0(0, *clock, &s0, config);
+  RxTxPair p1(1, *clock, &s1, config);
+  StartPair(&p0, &p1, clock);
+  auto tick = [&]() {
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(100);
+  };
+  const unsigned char message[2] = {5, 6};
+  ASSERT_TRUE(p0.Transmit(message, 2));
+  unsigned long deadline;
+  ASSERT_TRUE(p0.NextDeadline(&deadline));
+  EXPECT_EQ(clock->micros() + 1000, deadline);
+  unsigned char length;
+  for (int i = 0; i < 5; ++i) tick();
+  EXPECT_EQ(nullptr, p1.Receive(&length));
+  for (int i = 0; i < 10; ++i) tick();
+  const unsigned char *data = p1.Receive(&length);
+  ASSERT_NE(nullptr, data);
+  EXPECT_EQ(2, length);
+  EXPECT_EQ(6, data[1]);
+
+  // An explicit flush sends it on the next tick, and the longest message
+  // still fits.
+  unsigned char longest[MAX_DATA_SIZE - 1];
+  memset(longest, 7, sizeof(longest));
+  ASSERT_TRUE(p0.Transmit(message, 2));
+  ASSERT_TRUE(p0.Transmit(longest, sizeof(longest)));
+  EXPECT_FALSE(p0.Transmit(longest, MAX_DATA_SIZE));
+  ASSERT_TRUE(p0.Flush());
+  for (int i = 0; i < 3; ++i) tick();
+  ASSERT_NE(nullptr, p1.Receive(&length));
+  EXPECT_EQ(2, length);
+  data = p1.Receive(&length);
+  ASSERT_NE(nullptr, data);
+  EXPECT_EQ(sizeof(longest), length);
+  EXPECT_EQ(0, memcmp(longest, data, length));
+  EXPECT_EQ(nullptr, p1.Receive(&length));
+}
+
+// Frames p0 writes in a single tick with eight messages queued.
+int BurstFrames(const LinkConfig &config, const size_t tx_space) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  LossySerial counting(&s0, 0);
+  FakeClock *clock = GetFakeClock();
+  RxTxPair p0(0, *clock, &counting, config);
+  RxTxPair p1(1, *clock, &s1, config);
+  StartPair(&p0, &p1, clock);
+  for (int i = 0; i < 8; ++i) {
+    const unsigned char message[1] = {static_cast<unsigned char>(i)};
+    EXPECT_TRUE(p0.Transmit(message, 1));
+  }
+  counting.SetTxSpace(tx_space);
+  const int start_frames = counting.frames();
+  p0.Tick();
+  const int frames = counting.frames() - start_frames;
+  // They all arrive in order.
+  int received = 0;
+  for (int ticks = 0; ticks < 100 && received < 8; ++ticks) {
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(100);
+    unsigned char length;
+    const unsigned char *data;
+    while ((data = p1.Receive(&length)) != nullptr) {
+      EXPECT_EQ(received, data[0]);
+      ++received;
+    }
+  }
+  EXPECT_EQ(8, received);
+  return frames;
+}
+
+TEST(PairTest, WriteBursts) {
+  LinkConfig config;
+  config.window_size = 8;
+  config.cumulative_ack = true;
+  const size_t unlimited = static_cast<size_t>(-1);
+  EXPECT_EQ(1, BurstFrames(config, unlimited));
+  config.write_budget_bytes = 1000;
+  EXPECT_EQ(8, BurstFrames(config, unlimited));
+  // Basic frames with one byte of data are 10 bytes; a new frame starts
+  // while fewer than 25 bytes have gone out.
+  config.write_budget_bytes = 25;
+  EXPECT_EQ(3, BurstFrames(config, unlimited));
+  // The first frame always goes; more only while the port has room.
+  config.write_budget_bytes = 1000;
+  EXPECT_EQ(1, BurstFrames(config, 10));
+  EXPECT_EQ(8, BurstFrames(config, 100));
+}
+
+TEST(PairTest, DeadlineCoversInputAndDelayedAcks) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  FakeClock *clock = GetFakeClock();
+  LinkConfig config;
+  config.cumulative_ack = true;
+  config.ack_delay_micros = 2000;
+  config.ack_every_packets = 4;
+  RxTxPair p0(0, *clock, &s0, config);
+  RxTxPair p1(1, *clock, &s1, config);
+  StartPair(&p0, &p1, clock);
+  p0.Tick();
+  unsigned long deadline;
+  EXPECT_FALSE(p1.NextDeadline(&deadline));
+  // A message waiting to go needs a tick right away.
+  const unsigned char message[1] = {3};
+  ASSERT_TRUE(p0.Transmit(message, 1));
+  ASSERT_TRUE(p0.NextDeadline(&deadline));
+  EXPECT_EQ(clock->micros(), deadline);
+  p0.Tick();
+  // So does input waiting to be read.
+  ASSERT_TRUE(p1.NextDeadline(&deadline));
+  EXPECT_EQ(clock->micros(), deadline);
+  p1.Tick();
+  unsigned char length;
+  ASSERT_NE(nullptr, p1.Receive(&length));
+  // Then the ack is held for its delay.
+  p1.Tick();
+  ASSERT_TRUE(p1.NextDeadline(&deadline));
+  EXPECT_EQ(clock->micros() + 2000, deadline);
+  clock->IncrementTime(2000);
+  p1.Tick();
+  EXPECT_FALSE(p1.NextDeadline(&deadline));
+}
+
+TEST(PairTest, DeadlineWaitsForRoomToWrite) {
+  MemorySerial s0, s1;
+  MemorySerial::Connect(&s0, &s1);
+  LossySerial port(&s0, 0);
+  FakeClock *clock = GetFakeClock();
+  RxTxPair p0(0, *clock, &port);
+  RxTxPair p1(1, *clock, &s1);
+  StartPair(&p0, &p1, clock);
+  p0.Tick();
+  p1.Tick();
+  const unsigned char message[1] = {3};
+  ASSERT_TRUE(p0.Transmit(message, 1));
+  // With no room to write, there is nothing to do until the port drains.
+  port.SetTxSpace(0);
+  unsigned long deadline;
+  EXPECT_FALSE(p0.NextDeadline(&deadline));
+  port.SetTxSpace(100);
+  ASSERT_TRUE(p0.NextDeadline(&deadline));
+  EXPECT_EQ(clock->micros(), deadline);
+}
+
 //TEST(PairTest, ReconnectWithIncomingJunk) {
 //  FakeArduino s0, s1;
 //  ASSERT_TRUE(s0.UseFiles("/tmp/send_bidir_a", "/tmp/send_bidir_b"));
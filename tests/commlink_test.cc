@@ -208,6 +208,63 @@ TEST(ReaderTest, SendErrorForValidPacketBadIndex) {
   EXPECT_EQ(reader.PopOutgoingAck().index(), 0x72);
 }
 
+TEST(ReaderTest, DrainsFramesWithoutWaitingForTheWriter) {
+  FakeArduino s0, s1;
+  ASSERT_TRUE(s0.UseFiles("/tmp/read_drain_a", "/tmp/read_drain_b"));
+  ASSERT_TRUE(s1.UseFiles("/tmp/read_drain_b", "/tmp/read_drain_a"));
+  Reader reader(0, &s1);
+  Initialize(&s0, &reader);
+  // Back to back frames, each carrying an ack.
+  for (unsigned char i = 1; i <= 3; ++i) WritePacket(Ack(0x70 + i), i, &s0);
+  while (reader.Read());
+  for (unsigned char i = 1; i <= 3; ++i) {
+    EXPECT_EQ(reader.PopOutgoingAck().index(), 0x70 + i);
+    Packet *popped = reader.PopPacket();
+    ASSERT_NE(popped, nullptr);
+    EXPECT_EQ(popped->index_sending(), i);
+  }
+  EXPECT_EQ(reader.PopOutgoingAck().index(), 0);
+}
+
+TEST(ReaderTest, StopsWhenAckQueueIsFull) {
+  FakeArduino s0, s1;
+  ASSERT_TRUE(s0.UseFiles("/tmp/read_ack_queue_a", "/tmp/read_ack_queue_b"));
+  ASSERT_TRUE(s1.UseFiles("/tmp/read_ack_queue_b", "/tmp/read_ack_queue_a"));
+  LinkConfig config;
+  config.window_size = 16;
+  Reader reader(0, &s1, config);
+  Initialize(&s0, &reader);
+  const unsigned int frames = ACK_QUEUE_SIZE + 2;
+  for (unsigned char i = 1; i <= frames; ++i) WritePacket(Ack(0x40 + i), i, &s0);
+  while (reader.Read());
+  // The rest wait in the serial buffer until the writer takes the acks.
+  for (unsigned int i = 1; i <= ACK_QUEUE_SIZE; ++i) {
+    EXPECT_EQ(reader.PopOutgoingAck().index(), 0x40 + i);
+  }
+  EXPECT_EQ(reader.PopOutgoingAck().index(), 0);
+  while (reader.Read());
+  EXPECT_EQ(reader.PopOutgoingAck().index(), 0x40 + ACK_QUEUE_SIZE + 1);
+  EXPECT_EQ(reader.PopOutgoingAck().index(), 0x40 + ACK_QUEUE_SIZE + 2);
+}
+
+TEST(AckQueueTest, MergeKeepsRealAcks) {
+  AckQueue queue;
+  Ack ack;
+  ack.Parse(false, 3);
+  EXPECT_TRUE(queue.Push(ack, true));
+  // An empty ack, from a frame at index 0, neither replaces it nor is
+  // replaced by the next one.
+  EXPECT_TRUE(queue.Push(Ack(), true));
+  ack.Parse(false, 4);
+  EXPECT_TRUE(queue.Push(ack, true));
+  ack.Parse(false, 5);
+  EXPECT_TRUE(queue.Push(ack, true));
+  EXPECT_EQ(3, queue.Pop().index());
+  EXPECT_EQ(0, queue.Pop().index());
+  EXPECT_EQ(5, queue.Pop().index());
+  EXPECT_TRUE(queue.empty());
+}
+
 // Doesn't work with reprocessing
 //TEST(ReaderTest, SendErrorForInvalidDataPacket) {
 //  FakeArduino s0, s1;
@@ -256,9 +313,8 @@ TEST(ReaderTest, HandleDuplicate1060) {
   EXPECT_FALSE(reader.Read());
   Initialize(&s0, &reader);
   // Write some initial junk, so we make sure it doesn't foul up the subsequent message.
-  // TODO: Handle duplicate 1060's
-  //s0.write(10);
-  //s0.write(60);
+  s0.write(10);
+  s0.write(60);
   s0.write(23);
   WritePacket(Ack(0x72), 1, &s0);
   while (reader.Read());
@@ -296,6 +352,44 @@ TEST(ReaderTest, ReadMany) {
   }
 }
 
+unsigned int SerializePacket(const Ack &ack, const unsigned char index, unsigned char *stream) {
+  Packet pt;
+  pt.IncludeAck(ack);
+  unsigned char data[1];
+  data[0] = index + 1;
+  pt.IncludeData(index, data, index == 0x80 ? 0 : 1);
+  unsigned int length;
+  pt.Serialize(stream, stream + 7, &length);
+  return 7 + length;
+}
+
+TEST(ReaderTest, ReadFromBuffer) {
+  Reader reader(0, nullptr);
+  unsigned char stream[64];
+  unsigned int stream_length = SerializePacket(Ack(0x00), 0x80, stream);
+  stream_length += SerializePacket(Ack(0x72), 1, stream + stream_length);
+  stream_length += SerializePacket(Ack(0x72), 2, stream + stream_length);
+  unsigned int offset = 0;
+  int popped_count = 0;
+  while (offset < stream_length) {
+    size_t consumed;
+    if (!reader.Read(stream + offset, stream_length - offset, &consumed)) {
+      // Blocked on acks; flush them the way the writer would.
+      Packet *popped = reader.PopPacket();
+      if (popped != nullptr) {
+        ++popped_count;
+        EXPECT_EQ(popped->index_sending(), popped_count);
+      }
+      reader.PopIncomingAck();
+      reader.PopOutgoingAck();
+    }
+    offset += consumed;
+  }
+  EXPECT_TRUE(reader.Initialized());
+  while (reader.PopPacket() != nullptr) ++popped_count;
+  EXPECT_EQ(popped_count, 2);
+}
+
 TEST(OutgoingPacketBufferTest, AllocateUntilFull) {
   OutgoingPacketBuffer b(0);
   b.MarkSequenceStarted();
@@ -449,9 +543,13 @@ class FakeAcker : public AckProvider {
   void WithOutgoing(const Ack &ack) {
     outgoing_ack_ = ack;
   }
+
+  bool CumulativeAck() const override { return cumulative_ack_; }
+  void WithCumulativeAck() { cumulative_ack_ = true; }
  private:
   Ack incoming_ack_;
   Ack outgoing_ack_;
+  bool cumulative_ack_ = false;
 };
 
 TEST(WriterTest, AddToOutgoingQueue) {
@@ -516,6 +614,8 @@ TEST(WriterTest, WriteOne) {
   EXPECT_EQ(p->data(&length)[2], 17);
 
   EXPECT_EQ(remote_reader.PopOutgoingAck().index(), 0);
+  // The start sequence is acked first.
+  EXPECT_TRUE(remote_reader.PopIncomingAck().is_start_sequence_ack());
   const Ack incoming_ack = remote_reader.PopIncomingAck();
   EXPECT_EQ(incoming_ack.index(), 1);
   EXPECT_TRUE(incoming_ack.ok());
@@ -558,6 +658,9 @@ TEST(WriterTest, WriteMany) {
       EXPECT_EQ(p->data(&length)[2], 17);
 
       EXPECT_EQ(real_reader.PopOutgoingAck().index(), 0);
+      if (i == 0) {
+        EXPECT_TRUE(real_reader.PopIncomingAck().is_start_sequence_ack());
+      }
       const Ack incoming_ack = real_reader.PopIncomingAck();
       EXPECT_EQ(incoming_ack.index(), ToIndex(i));
       EXPECT_TRUE(incoming_ack.ok());
@@ -727,5 +830,528 @@ TEST(WriterTest, SendAckOnly) {
   EXPECT_EQ(reader.PopOutgoingAck().index(), 0x71);
 }
 
+// Fills a buffer configured for selective acks with packets 1 to count, and
+// sends them all.
+void FillSelectiveBuffer(const int count, OutgoingPacketBuffer *b) {
+  b->Configure(8, MAX_EXTENDED_INDEX);
+  b->MarkSequenceStarted();
+  for (int i = 0; i < count; ++i) {
+    Packet *p = b->AllocatePacket();
+    ASSERT_NE(p, nullptr);
+    FillPacket(Ack(0x72), i + 1, p);
+  }
+  for (int i = 0; i < count; ++i) {
+    Packet *p = b->NextPacket();
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ(i + 1, p->index_sending());
+    b->MarkSent(p->index_sending(), 0);
+  }
+  EXPECT_EQ(b->NextPacket(), nullptr);
+}
+
+TEST(OutgoingPacketBufferTest, SelectiveAckResendsOnlyGaps) {
+  OutgoingPacketBuffer b(0);
+  FillSelectiveBuffer(6, &b);
+  // 1 arrived in order; 3 and 5 arrived after gaps.
+  Ack ack;
+  ack.Parse(false, 1);
+  ack.SetSelective(1);
+  ack.SetSelective(3);
+  b.AckThrough(ack.index());
+  b.MarkSelective(ack);
+  EXPECT_EQ(b.PeekPacket(1), nullptr);
+  Packet *p = b.NextPacket();
+  ASSERT_NE(p, nullptr);
+  EXPECT_EQ(2, p->index_sending());
+  b.MarkSent(2, 0);
+  p = b.NextPacket();
+  ASSERT_NE(p, nullptr);
+  EXPECT_EQ(4, p->index_sending());
+  b.MarkSent(4, 0);
+  // 6 may still be in flight.
+  EXPECT_EQ(b.NextPacket(), nullptr);
+
+  // The same report again brings no news, so nothing is resent.
+  b.MarkSelective(ack);
+  EXPECT_EQ(b.NextPacket(), nullptr);
+
+  // A timeout resends everything not selectively acked.
+  b.MarkAllResend();
+  for (const int expected : {2, 4, 6}) {
+    p = b.PeekResendPacket();
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ(expected, p->index_sending());
+  }
+  EXPECT_EQ(b.PeekResendPacket(), nullptr);
+}
+
+TEST(OutgoingPacketBufferTest, SelectivelyAckedPacketsHoldTheirSlot) {
+  OutgoingPacketBuffer b(0);
+  FillSelectiveBuffer(8, &b);
+  Ack ack;
+  ack.SetSelective(1);
+  ack.SetSelective(2);
+  b.MarkSelective(ack);
+  // Still counted against the window until the cumulative ack passes them.
+  EXPECT_EQ(b.AllocatePacket(), nullptr);
+  EXPECT_NE(b.PeekPacket(2), nullptr);
+  b.AckThrough(3);
+  EXPECT_EQ(b.PeekPacket(2), nullptr);
+  EXPECT_EQ(b.PeekPacket(3), nullptr);
+  EXPECT_NE(b.PeekPacket(4), nullptr);
+  EXPECT_NE(b.AllocatePacket(), nullptr);
+}
+
+TEST(PacketRingBufferTest, SelectiveAck) {
+  PacketRingBuffer rb;
+  rb.Configure(8, MAX_EXTENDED_INDEX);
+  for (const int index : {1, 3, 4, 7}) {
+    Packet *p = rb.AllocatePacket();
+    ASSERT_NE(p, nullptr);
+    FillPacket(Ack(0x70), index, p);
+  }
+  ASSERT_NE(rb.PopPacket(), nullptr);
+  EXPECT_EQ(rb.PopPacket(), nullptr);
+  const Ack ack = rb.SelectiveAck();
+  EXPECT_EQ(1, ack.index());
+  EXPECT_FALSE(ack.selective(0));
+  EXPECT_TRUE(ack.selective(1));
+  EXPECT_TRUE(ack.selective(2));
+  EXPECT_FALSE(ack.selective(3));
+  EXPECT_FALSE(ack.selective(4));
+  EXPECT_TRUE(ack.selective(5));
+}
+
+TEST(OutgoingPacketBufferTest, SentOnceSkipsResentPackets) {
+  OutgoingPacketBuffer b(0);
+  b.MarkSequenceStarted();
+  FillPacket(Ack(0x72), 1, b.AllocatePacket());
+  unsigned long sent_time;
+  EXPECT_FALSE(b.SentOnce(1, &sent_time));
+  b.MarkSent(1, 500);
+  ASSERT_TRUE(b.SentOnce(1, &sent_time));
+  EXPECT_EQ(500, sent_time);
+  // An ack may now be for either copy.
+  b.MarkSent(1, 900);
+  EXPECT_FALSE(b.SentOnce(1, &sent_time));
+  EXPECT_FALSE(b.SentOnce(2, &sent_time));
+}
+
+TEST(OutgoingPacketBufferTest, PerPacketExpiry) {
+  OutgoingPacketBuffer b(0);
+  b.MarkSequenceStarted();
+  for (int i = 1; i <= 3; ++i) {
+    FillPacket(Ack(0x72), i, b.AllocatePacket());
+    b.MarkSent(b.NextPacket()->index_sending(), i * 500);
+  }
+  unsigned long sent_time;
+  ASSERT_TRUE(b.OldestSendTime(1500, &sent_time));
+  EXPECT_EQ(500, sent_time);
+  // Only packet 1 has waited a full timeout.
+  EXPECT_FALSE(b.MarkExpired(1500, 1001));
+  EXPECT_TRUE(b.MarkExpired(1700, 1000));
+  Packet *p = b.NextPacket();
+  ASSERT_NE(p, nullptr);
+  EXPECT_EQ(1, p->index_sending());
+  b.MarkSent(1, 1700);
+  EXPECT_EQ(b.NextPacket(), nullptr);
+  EXPECT_EQ(2, b.SendCount(1));
+  EXPECT_EQ(1, b.SendCount(2));
+  ASSERT_TRUE(b.OldestSendTime(1700, &sent_time));
+  EXPECT_EQ(1000, sent_time);
+  // Packets 2 and 3 expire later, each on its own timer.
+  EXPECT_TRUE(b.MarkExpired(2100, 1000));
+  p = b.NextPacket();
+  ASSERT_NE(p, nullptr);
+  EXPECT_EQ(2, p->index_sending());
+  b.MarkSent(2, 2100);
+  EXPECT_EQ(b.NextPacket(), nullptr);
+  b.RemovePacket(1);
+  b.RemovePacket(2);
+  b.RemovePacket(3);
+  EXPECT_FALSE(b.OldestSendTime(2100, &sent_time));
+  EXPECT_EQ(0, b.SendCount(1));
+}
+
+TEST(OutgoingPacketBufferTest, ExpiryWrapsWithClock) {
+  OutgoingPacketBuffer b(0);
+  b.MarkSequenceStarted();
+  FillPacket(Ack(0x72), 1, b.AllocatePacket());
+  const unsigned long before_wrap = static_cast<unsigned long>(-500);
+  b.MarkSent(1, before_wrap);
+  EXPECT_FALSE(b.MarkExpired(400, 1000));
+  EXPECT_TRUE(b.MarkExpired(600, 1000));
+}
+
+TEST(PacketRingBufferTest, PlacesOutOfOrderPackets) {
+  PacketRingBuffer rb;
+  rb.Configure(8, MAX_BASIC_INDEX);
+  for (const int index : {3, 1, 3, 2}) {
+    Packet *p = rb.AllocatePacket();
+    ASSERT_NE(p, nullptr);
+    FillPacket(Ack(0x70), index, p);
+  }
+  for (int index = 1; index <= 3; ++index) {
+    Packet *p = rb.PopPacket();
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ(index, p->index_sending());
+  }
+  // The duplicate 3 was dropped.
+  EXPECT_EQ(rb.PopPacket(), nullptr);
+}
+
+TEST(PacketRingBufferTest, WideWindowWraps) {
+  PacketRingBuffer rb;
+  const unsigned int window = BUFFER_SIZE < 64 ? BUFFER_SIZE : 64;
+  rb.Configure(window, MAX_BASIC_INDEX);
+  // Fills the window back to front, then pops it in order, across the wrap
+  // from 127 to 1.
+  unsigned int next = 1;
+  for (int round = 0; round < 20; ++round) {
+    for (int i = window - 1; i >= 0; --i) {
+      Packet *p = rb.AllocatePacket();
+      ASSERT_NE(p, nullptr);
+      FillPacket(Ack(0x70), (next - 1 + i) % MAX_BASIC_INDEX + 1, p);
+    }
+    for (unsigned int i = 0; i < window; ++i) {
+      Packet *p = rb.PopPacket();
+      ASSERT_NE(p, nullptr);
+      EXPECT_EQ(next, p->index_sending());
+      next = next % MAX_BASIC_INDEX + 1;
+    }
+    EXPECT_EQ(rb.PopPacket(), nullptr);
+  }
+}
+
+TEST(OutgoingPacketBufferTest, WindowSpansFromOldestUnacked) {
+  OutgoingPacketBuffer b(0);
+  b.MarkSequenceStarted();
+  for (int i = 0; i < 4; ++i) {
+    FillPacket(Ack(0x72), i + 1, b.AllocatePacket());
+  }
+  // Packet 1 still holds the window open at 1 to 4.
+  b.RemovePacket(3);
+  EXPECT_EQ(b.AllocatePacket(), nullptr);
+  b.RemovePacket(1);
+  EXPECT_EQ(b.PeekPacket(1), nullptr);
+  EXPECT_NE(b.PeekPacket(2), nullptr);
+  FillPacket(Ack(0x72), 5, b.AllocatePacket());
+  EXPECT_EQ(b.AllocatePacket(), nullptr);
+  b.RemovePacket(2);
+  // 3 was freed already, so this opens two slots.
+  FillPacket(Ack(0x72), 6, b.AllocatePacket());
+  FillPacket(Ack(0x72), 7, b.AllocatePacket());
+  EXPECT_EQ(b.AllocatePacket(), nullptr);
+  for (const int index : {4, 5, 6, 7}) {
+    Packet *p = b.PeekPacket(index);
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ(index, p->index_sending());
+  }
+}
+
+TEST(OutgoingPacketBufferTest, WideWindowWraps) {
+  OutgoingPacketBuffer b(0);
+  const unsigned int window = BUFFER_SIZE < 64 ? BUFFER_SIZE : 64;
+  b.Configure(window, MAX_EXTENDED_INDEX);
+  b.MarkSequenceStarted();
+  // Runs past MAX_EXTENDED_INDEX, acking half the window at a time.
+  unsigned int next = 1;
+  unsigned int acked = 0;
+  for (int round = 0; round < 2 * MAX_EXTENDED_INDEX / window + 2; ++round) {
+    Packet *p;
+    const unsigned char data[1] = {0};
+    while ((p = b.AllocatePacket()) != nullptr) {
+      p->UseExtendedHeader(true);
+      p->IncludeData(next, data, 1);
+      next = next % MAX_EXTENDED_INDEX + 1;
+    }
+    while ((p = b.NextPacket()) != nullptr) {
+      b.MarkSent(p->index_sending(), 0);
+    }
+    const unsigned int through = (acked + window / 2 - 1) % MAX_EXTENDED_INDEX + 1;
+    b.AckThrough(through);
+    EXPECT_EQ(b.PeekPacket(through), nullptr);
+    ASSERT_NE(b.PeekPacket(through % MAX_EXTENDED_INDEX + 1), nullptr);
+    acked = through;
+  }
+}
+
+TEST(PacketRingBufferTest, ReceivedAckCarriesCredit) {
+  PacketRingBuffer rb;
+  rb.Configure(4, MAX_EXTENDED_INDEX, true);
+  for (const int index : {1, 2, 4}) {
+    Packet *p = rb.AllocatePacket();
+    ASSERT_NE(p, nullptr);
+    FillPacket(Ack(0x70), index, p);
+  }
+  EXPECT_TRUE(rb.MissingBefore(4));
+  EXPECT_FALSE(rb.MissingBefore(3));
+  Ack ack = rb.ReceivedAck(true);
+  EXPECT_EQ(2, ack.index());
+  EXPECT_EQ(2, ack.credit());
+  EXPECT_FALSE(ack.selective(0));
+  EXPECT_TRUE(ack.selective(1));
+  // A full window still leaves the spare slot for parsing.
+  FillPacket(Ack(0x70), 3, rb.AllocatePacket());
+  ack = rb.ReceivedAck(false);
+  EXPECT_EQ(4, ack.index());
+  EXPECT_EQ(0, ack.credit());
+  EXPECT_FALSE(ack.has_selective());
+  ASSERT_NE(rb.AllocatePacket(), nullptr);
+  EXPECT_TRUE(rb.full());
+  // Popping opens the window again.
+  ASSERT_NE(rb.PopPacket(), nullptr);
+  ack = rb.ReceivedAck(false);
+  EXPECT_EQ(4, ack.index());
+  EXPECT_EQ(1, ack.credit());
+}
+
+TEST(OutgoingPacketBufferTest, StopsAtCreditLimit) {
+  OutgoingPacketBuffer b(0);
+  b.Configure(8, MAX_EXTENDED_INDEX);
+  b.MarkSequenceStarted();
+  for (int i = 1; i <= 5; ++i) {
+    FillPacket(Ack(0x72), i, b.AllocatePacket());
+  }
+  b.SetCredit(0, 2);
+  for (const int index : {1, 2}) {
+    Packet *p = b.NextPacket();
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ(index, p->index_sending());
+    b.MarkSent(index, 0);
+  }
+  EXPECT_EQ(b.NextPacket(), nullptr);
+  EXPECT_TRUE(b.CreditBlocked());
+  // A probe past the limit is dropped by the other end, so more credit
+  // sends it again.
+  Packet *probe = b.ProbePacket();
+  ASSERT_NE(probe, nullptr);
+  EXPECT_EQ(3, probe->index_sending());
+  b.MarkSent(3, 0);
+  b.AckThrough(2);
+  b.SetCredit(2, 2);
+  EXPECT_FALSE(b.CreditBlocked());
+  Packet *p = b.NextPacket();
+  ASSERT_NE(p, nullptr);
+  EXPECT_EQ(3, p->index_sending());
+  b.MarkSent(3, 0);
+  p = b.NextPacket();
+  ASSERT_NE(p, nullptr);
+  EXPECT_EQ(4, p->index_sending());
+  b.MarkSent(4, 0);
+  EXPECT_EQ(b.NextPacket(), nullptr);
+}
+
+TEST(OutgoingPacketBufferTest, SupersedeKeyFindsUnsentPacket) {
+  OutgoingPacketBuffer b(0);
+  b.MarkSequenceStarted();
+  FillPacket(Ack(0x72), 1, b.AllocatePacket(7));
+  FillPacket(Ack(0x72), 2, b.AllocatePacket());
+  FillPacket(Ack(0x72), 3, b.AllocatePacket(8));
+  Packet *p = b.UnsentPacket(7);
+  ASSERT_NE(p, nullptr);
+  EXPECT_EQ(1, p->index_sending());
+  ASSERT_NE(b.UnsentPacket(8), nullptr);
+  EXPECT_EQ(3, b.UnsentPacket(8)->index_sending());
+  EXPECT_EQ(b.UnsentPacket(9), nullptr);
+  // Once sent, even if it must be resent, it can no longer be replaced.
+  b.MarkSent(1, 0);
+  b.MarkResend(1);
+  EXPECT_EQ(b.UnsentPacket(7), nullptr);
+  // A slot reused without a key has none.
+  b.RemovePacket(1);
+  FillPacket(Ack(0x72), 4, b.AllocatePacket());
+  EXPECT_EQ(b.UnsentPacket(7), nullptr);
+}
+
+// Starts the reader's sequence with a peer offering the given capabilities.
+void InitializeWithCapabilities(const unsigned char capabilities, FakeArduino *write_path,
+    Reader *reader) {
+  const unsigned char settings[3] = {capabilities, 0, 4};
+  Packet start;
+  start.IncludeData(0x80, settings, 3);
+  unsigned int length;
+  const unsigned char *frame = start.frame(&length);
+  write_path->write(frame, length);
+  while (reader->Read());
+  EXPECT_TRUE(reader->PopIncomingAck().is_start_sequence_ack());
+}
+
+TEST(ReaderTest, DelayedCumulativeAck) {
+  FakeArduino s0, s1;
+  ASSERT_TRUE(s0.UseFiles("/tmp/delayed_ack_a", "/tmp/delayed_ack_b"));
+  ASSERT_TRUE(s1.UseFiles("/tmp/delayed_ack_b", "/tmp/delayed_ack_a"));
+  LinkConfig config;
+  config.cumulative_ack = true;
+  config.ack_delay_micros = 1000;
+  config.ack_every_packets = 3;
+  Reader reader(0, &s1, config);
+  InitializeWithCapabilities(CAPABILITY_CUMULATIVE_ACK, &s0, &reader);
+  ASSERT_TRUE(reader.CumulativeAck());
+  EXPECT_FALSE(reader.IncomingAckDue(0));
+
+  for (int i = 1; i <= 2; ++i) {
+    WritePacket(Ack(0x00), i, &s0);
+  }
+  // Reading doesn't wait on acks for popped packets.
+  while (reader.Read());
+  ASSERT_NE(reader.PopPacket(), nullptr);
+  ASSERT_NE(reader.PopPacket(), nullptr);
+  // Held for the delay, counted from the first check.
+  EXPECT_FALSE(reader.IncomingAckDue(5000));
+  EXPECT_FALSE(reader.IncomingAckDue(5999));
+  EXPECT_TRUE(reader.IncomingAckDue(6000));
+  Ack ack = reader.PopIncomingAck();
+  EXPECT_EQ(2, ack.index());
+  EXPECT_FALSE(ack.error());
+  EXPECT_FALSE(reader.IncomingAckDue(7000));
+
+  // Or until enough packets are waiting.
+  for (int i = 3; i <= 5; ++i) {
+    WritePacket(Ack(0x00), i, &s0);
+  }
+  while (reader.Read());
+  for (int i = 3; i <= 5; ++i) {
+    ASSERT_NE(reader.PopPacket(), nullptr);
+  }
+  EXPECT_TRUE(reader.IncomingAckDue(7000));
+  EXPECT_EQ(5, reader.PopIncomingAck().index());
+
+  // A repeated packet means our ack went missing, so it goes right away.
+  WritePacket(Ack(0x00), 5, &s0);
+  while (reader.Read());
+  EXPECT_EQ(reader.PopPacket(), nullptr);
+  EXPECT_TRUE(reader.IncomingAckDue(7000));
+  EXPECT_EQ(5, reader.PopIncomingAck().index());
+}
+
+TEST(ReaderTest, CumulativeAckNeedsBothEnds) {
+  FakeArduino s0, s1;
+  ASSERT_TRUE(s0.UseFiles("/tmp/cumulative_one_sided_a", "/tmp/cumulative_one_sided_b"));
+  ASSERT_TRUE(s1.UseFiles("/tmp/cumulative_one_sided_b", "/tmp/cumulative_one_sided_a"));
+  LinkConfig config;
+  config.cumulative_ack = true;
+  config.ack_delay_micros = 1000;
+  Reader reader(0, &s1, config);
+  InitializeWithCapabilities(0, &s0, &reader);
+  EXPECT_FALSE(reader.CumulativeAck());
+  WritePacket(Ack(0x00), 1, &s0);
+  while (reader.Read());
+  ASSERT_NE(reader.PopPacket(), nullptr);
+  EXPECT_TRUE(reader.IncomingAckDue(0));
+  EXPECT_EQ(1, reader.PopIncomingAck().index());
+}
+
+TEST(WriterTest, CumulativeAckRemovesEarlierPackets) {
+  FakeAcker reader;
+  FakeArduino s0, s1;
+  ASSERT_TRUE(s0.UseFiles("/tmp/writer_cumulative_a", "/tmp/writer_cumulative_b"));
+  ASSERT_TRUE(s1.UseFiles("/tmp/writer_cumulative_b", "/tmp/writer_cumulative_a"));
+  reader.WithCumulativeAck();
+  Writer writer(0, *GetFakeClock(), &s1, &reader);
+  writer.Write();
+  Ack start_ack;
+  start_ack.AckStartSequence();
+  reader.WithOutgoing(start_ack);
+  writer.Write();
+  ASSERT_TRUE(writer.Initialized());
+  const unsigned char data[1] = {9};
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(writer.AddToOutgoingQueue(data, 1));
+    writer.Write();
+  }
+  EXPECT_FALSE(writer.AddToOutgoingQueue(data, 1));
+  // One ack frees the first three, without resending anything.
+  reader.WithOutgoing(Ack(0x03));
+  EXPECT_FALSE(writer.Write());
+  EXPECT_TRUE(writer.AddToOutgoingQueue(data, 1));
+  EXPECT_TRUE(writer.AddToOutgoingQueue(data, 1));
+  EXPECT_TRUE(writer.AddToOutgoingQueue(data, 1));
+  EXPECT_FALSE(writer.AddToOutgoingQueue(data, 1));
+}
+
+TEST(WriterTest, SupersedeReplacesQueuedMessage) {
+  FakeAcker reader;
+  FakeArduino s0, s1;
+  ASSERT_TRUE(s0.UseFiles("/tmp/writer_supersede_a", "/tmp/writer_supersede_b"));
+  ASSERT_TRUE(s1.UseFiles("/tmp/writer_supersede_b", "/tmp/writer_supersede_a"));
+  Writer writer(0, *GetFakeClock(), &s1, &reader);
+  writer.Write();
+  Ack start_ack;
+  start_ack.AckStartSequence();
+  reader.WithOutgoing(start_ack);
+  writer.Write();
+  ASSERT_TRUE(writer.Initialized());
+  // Many moves, one slot: each replaces the last until it goes out.
+  for (unsigned char i = 0; i < 10; ++i) {
+    const unsigned char move[2] = {0x11, i};
+    ASSERT_TRUE(writer.AddToOutgoingQueue(move, 2, 0x11));
+  }
+  const unsigned char other[1] = {0x12};
+  ASSERT_TRUE(writer.AddToOutgoingQueue(other, 1));
+  ASSERT_TRUE(writer.AddToOutgoingQueue(other, 1));
+  ASSERT_TRUE(writer.AddToOutgoingQueue(other, 1));
+  EXPECT_FALSE(writer.AddToOutgoingQueue(other, 1));
+  // Still replaceable with the window full.
+  const unsigned char last[2] = {0x11, 99};
+  EXPECT_TRUE(writer.AddToOutgoingQueue(last, 2, 0x11));
+  ASSERT_TRUE(writer.Write());
+
+  Packet sent;
+  unsigned char bytes[MAX_FRAME_SIZE];
+  const size_t read = s0.read(bytes, MAX_FRAME_SIZE);
+  size_t consumed;
+  // The start sequence went out first; the move follows it.
+  ASSERT_EQ(PARSED, sent.Parse(bytes, read, &consumed));
+  EXPECT_TRUE(sent.start_sequence());
+  sent.Reset();
+  ASSERT_EQ(PARSED, sent.Parse(bytes + consumed, read - consumed, &consumed));
+  EXPECT_EQ(1, sent.index_sending());
+  unsigned char data_length;
+  const unsigned char *data = sent.data(&data_length);
+  ASSERT_EQ(2, data_length);
+  EXPECT_EQ(99, data[1]);
+  // Sent, so a new move takes a slot of its own.
+  EXPECT_FALSE(writer.AddToOutgoingQueue(last, 2, 0x11));
+}
+
+// Parses one frame carrying data at index.
+void ReadFrame(const unsigned int index, const unsigned char *data, const unsigned int length,
+    Reader *reader) {
+  Packet p;
+  p.IncludeData(index, data, length);
+  unsigned int frame_length;
+  const unsigned char *frame = p.frame(&frame_length);
+  size_t consumed;
+  EXPECT_TRUE(reader->Read(frame, frame_length, &consumed));
+  EXPECT_EQ(frame_length, consumed);
+}
+
+TEST(ReaderTest, RestartDropsPartlyReadBatch) {
+  LinkConfig config;
+  config.batch = true;
+  Reader reader(0, nullptr, config);
+  const unsigned char settings[3] = {CAPABILITY_BATCH, 0, 4};
+  ReadFrame(0x80, settings, 3, &reader);
+  ASSERT_TRUE(reader.Batch());
+  const unsigned char batch[5] = {2, 1, 2, 1, 3};
+  ReadFrame(1, batch, 5, &reader);
+  unsigned char length;
+  const unsigned char *message = reader.PopBatchedMessage(&length);
+  ASSERT_NE(nullptr, message);
+  EXPECT_EQ(2, length);
+
+  // The other end restarts before the rest of the batch is read.
+  ReadFrame(0x80, settings, 3, &reader);
+  const unsigned char restarted[3] = {2, 5, 6};
+  ReadFrame(1, restarted, 3, &reader);
+  message = reader.PopBatchedMessage(&length);
+  ASSERT_NE(nullptr, message);
+  ASSERT_EQ(2, length);
+  EXPECT_EQ(5, message[0]);
+  EXPECT_EQ(6, message[1]);
+  EXPECT_EQ(nullptr, reader.PopBatchedMessage(&length));
+}
+
 }  // namespace
 }  // namespace tensixty
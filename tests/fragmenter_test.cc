@@ -0,0 +1,155 @@
+// Using https://github.com/google/googletest
+#include <gtest/gtest.h>
+#include "cc/fragmenter.h"
+#include "cc/commlink.h"
+#include "arduino_simulator.h"
+#include "memory_serial.h"
+
+namespace tensixty {
+
+namespace {
+
+void FillMessage(const unsigned int seed, const unsigned int length, unsigned char *data) {
+  for (unsigned int i = 0; i < length; ++i) {
+    data[i] = (seed * 31 + i * 7) & 0xff;
+  }
+}
+
+class FragmenterTest : public ::testing::Test {
+ protected:
+  void Start() {
+    MemorySerial::Connect(&s0_, &s1_);
+    LinkConfig config;
+    config.window_size = 16;
+    config.cumulative_ack = true;
+    p0_ = new RxTxPair(0, *clock_, &s0_, config);
+    p1_ = new RxTxPair(1, *clock_, &s1_, config);
+    f0_ = new Fragmenter(p0_);
+    f1_ = new Fragmenter(p1_);
+    for (int i = 0; i < 20; ++i) Tick();
+    ASSERT_TRUE(p0_->Initialized());
+    ASSERT_TRUE(p1_->Initialized());
+  }
+
+  void TearDown() override {
+    delete f0_;
+    delete f1_;
+    delete p0_;
+    delete p1_;
+  }
+
+  void Tick() {
+    p0_->Tick();
+    p1_->Tick();
+    clock_->IncrementTime(100);
+    if (f0_ != nullptr) {
+      f0_->Update();
+      f1_->Update();
+    }
+  }
+
+  MemorySerial s0_, s1_;
+  FakeClock *clock_ = GetFakeClock();
+  RxTxPair *p0_ = nullptr;
+  RxTxPair *p1_ = nullptr;
+  Fragmenter *f0_ = nullptr;
+  Fragmenter *f1_ = nullptr;
+};
+
+TEST_F(FragmenterTest, RejectsEmptyAndOversizedMessages) {
+  RxTxPair pair(0, *clock_, &s0_);
+  Fragmenter f(&pair);
+  unsigned char data[1] = {0};
+  EXPECT_FALSE(f.Transmit(data, 0));
+  EXPECT_FALSE(f.Transmit(data, MAX_FRAGMENTED_MESSAGE_SIZE + 1));
+  for (unsigned int i = 0; i < MAX_FRAGMENTED_MESSAGES; ++i) {
+    EXPECT_TRUE(f.Transmit(data, 1));
+  }
+  EXPECT_FALSE(f.Transmit(data, 1));
+  EXPECT_TRUE(f.Sending(data));
+}
+
+TEST_F(FragmenterTest, ReassemblesInterleavedMessages) {
+  Start();
+  // A long message, then short ones that overtake it.
+  static unsigned char blob[3000];
+  unsigned char small[2][100];
+  FillMessage(1, sizeof(blob), blob);
+  FillMessage(2, sizeof(small[0]), small[0]);
+  FillMessage(3, sizeof(small[1]), small[1]);
+  static unsigned char buffers[3][4000];
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(f1_->AddBuffer(buffers[i], sizeof(buffers[i])));
+  }
+  ASSERT_TRUE(f0_->Transmit(blob, sizeof(blob)));
+  ASSERT_TRUE(f0_->Transmit(small[0], sizeof(small[0])));
+  ASSERT_TRUE(f0_->Transmit(small[1], sizeof(small[1])));
+
+  unsigned char *received[3] = {nullptr, nullptr, nullptr};
+  unsigned int lengths[3];
+  int count = 0;
+  for (int ticks = 0; ticks < 1000 && count < 3; ++ticks) {
+    Tick();
+    unsigned char *message;
+    while (count < 3 && (message = f1_->Receive(&lengths[count])) != nullptr) {
+      received[count++] = message;
+    }
+  }
+  ASSERT_EQ(3, count);
+  EXPECT_FALSE(f0_->Sending(blob));
+  // The short messages finish first.
+  EXPECT_EQ(sizeof(small[0]), lengths[0]);
+  EXPECT_EQ(0, memcmp(small[0], received[0], lengths[0]));
+  EXPECT_EQ(sizeof(small[1]), lengths[1]);
+  EXPECT_EQ(0, memcmp(small[1], received[1], lengths[1]));
+  ASSERT_EQ(sizeof(blob), lengths[2]);
+  EXPECT_EQ(0, memcmp(blob, received[2], lengths[2]));
+  EXPECT_EQ(0, f1_->dropped());
+}
+
+TEST_F(FragmenterTest, DropsMessagesWithoutABuffer) {
+  Start();
+  static unsigned char big[1000];
+  unsigned char small[10];
+  FillMessage(4, sizeof(big), big);
+  FillMessage(5, sizeof(small), small);
+  // Room for the small message only.
+  unsigned char buffer[100];
+  ASSERT_TRUE(f1_->AddBuffer(buffer, sizeof(buffer)));
+  ASSERT_TRUE(f0_->Transmit(big, sizeof(big)));
+  ASSERT_TRUE(f0_->Transmit(small, sizeof(small)));
+  unsigned int length = 0;
+  unsigned char *message = nullptr;
+  for (int ticks = 0; ticks < 1000 && message == nullptr; ++ticks) {
+    Tick();
+    message = f1_->Receive(&length);
+  }
+  ASSERT_EQ(buffer, message);
+  ASSERT_EQ(sizeof(small), length);
+  EXPECT_EQ(0, memcmp(small, buffer, length));
+  for (int ticks = 0; ticks < 100; ++ticks) Tick();
+  EXPECT_EQ(1, f1_->dropped());
+  EXPECT_EQ(nullptr, f1_->Receive(&length));
+}
+
+TEST_F(FragmenterTest, IgnoresFragmentsPastTheMessage) {
+  Start();
+  unsigned char buffer[20];
+  memset(buffer, 0xee, sizeof(buffer));
+  ASSERT_TRUE(f1_->AddBuffer(buffer, 10));
+  // The start of a 10 byte message, then a fragment far past its end.
+  const unsigned char first[FRAGMENT_HEADER_SIZE + 2] = {9, 0, 10, 0, 0, 1, 2};
+  const unsigned char stray[FRAGMENT_HEADER_SIZE + 8] = {9, 0, 10, 0xff, 0xfb, 3, 4, 5, 6, 7, 8, 9, 10};
+  ASSERT_TRUE(p0_->Transmit(first, sizeof(first)));
+  ASSERT_TRUE(p0_->Transmit(stray, sizeof(stray)));
+  for (int ticks = 0; ticks < 20; ++ticks) Tick();
+  unsigned int length;
+  EXPECT_EQ(nullptr, f1_->Receive(&length));
+  EXPECT_EQ(1, buffer[0]);
+  EXPECT_EQ(2, buffer[1]);
+  for (unsigned int i = 2; i < sizeof(buffer); ++i) EXPECT_EQ(0xee, buffer[i]);
+}
+
+}  // namespace
+
+}  // namespace tensixty
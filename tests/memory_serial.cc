@@ -0,0 +1,81 @@
+#include "memory_serial.h"
+#include <string.h>
+
+namespace tensixty {
+
+SpscByteRing::SpscByteRing(const size_t capacity)
+  : buffer_(capacity), read_(0), written_(0) {}
+
+size_t SpscByteRing::Write(const unsigned char *buf, size_t length) {
+  const size_t written = written_.load(std::memory_order_relaxed);
+  const size_t room = buffer_.size() - (written - read_.load(std::memory_order_acquire));
+  if (length > room) length = room;
+  // In at most two pieces, around the end of the buffer.
+  const size_t start = written % buffer_.size();
+  const size_t first = length < buffer_.size() - start ? length : buffer_.size() - start;
+  memcpy(&buffer_[start], buf, first);
+  memcpy(&buffer_[0], buf + first, length - first);
+  written_.store(written + length, std::memory_order_release);
+  return length;
+}
+
+size_t SpscByteRing::Read(unsigned char *buf, size_t length) {
+  const size_t read = read_.load(std::memory_order_relaxed);
+  const size_t used = written_.load(std::memory_order_acquire) - read;
+  if (length > used) length = used;
+  const size_t start = read % buffer_.size();
+  const size_t first = length < buffer_.size() - start ? length : buffer_.size() - start;
+  memcpy(buf, &buffer_[start], first);
+  memcpy(buf + first, &buffer_[0], length - first);
+  read_.store(read + length, std::memory_order_release);
+  return length;
+}
+
+size_t SpscByteRing::readable() const {
+  return written_.load(std::memory_order_acquire) - read_.load(std::memory_order_acquire);
+}
+
+size_t SpscByteRing::writable() const {
+  return buffer_.size() - readable();
+}
+
+MemorySerial::MemorySerial(const size_t capacity)
+  : incoming_(capacity), peer_(nullptr) {}
+
+void MemorySerial::Connect(MemorySerial *a, MemorySerial *b) {
+  a->peer_ = b;
+  b->peer_ = a;
+}
+
+void MemorySerial::write(const unsigned char c) {
+  write(&c, 1);
+}
+
+unsigned char MemorySerial::read() {
+  unsigned char c = 0xff;
+  incoming_.Read(&c, 1);
+  return c;
+}
+
+bool MemorySerial::available() {
+  return incoming_.readable() > 0;
+}
+
+size_t MemorySerial::write(const unsigned char *buf, const size_t length) {
+  if (peer_ == nullptr) return 0;
+  return peer_->incoming_.Write(buf, length);
+}
+
+size_t MemorySerial::read(unsigned char *buf, const size_t length) {
+  return incoming_.Read(buf, length);
+}
+
+size_t MemorySerial::available_bytes() {
+  return incoming_.readable();
+}
+
+size_t MemorySerial::available_for_write() {
+  return peer_ == nullptr ? 0 : peer_->incoming_.writable();
+}
+
+}  // namespace tensixty
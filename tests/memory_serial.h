@@ -0,0 +1,58 @@
+#ifndef TENSIXTY_TESTS_MEMORY_SERIAL_H_
+#define TENSIXTY_TESTS_MEMORY_SERIAL_H_
+
+#include "cc/serial_interface.h"
+#include <atomic>
+#include <vector>
+
+namespace tensixty {
+
+// A bounded ring of bytes with one writer and one reader, which may be on
+// different threads. Neither side ever waits on the other.
+class SpscByteRing {
+ public:
+  explicit SpscByteRing(size_t capacity);
+  // Copies in what fits, returning how much that was.
+  size_t Write(const unsigned char *buf, size_t length);
+  // Copies out up to length bytes, returning how many.
+  size_t Read(unsigned char *buf, size_t length);
+  size_t readable() const;
+  size_t writable() const;
+
+ private:
+  std::vector<unsigned char> buffer_;
+  // Bytes ever read and written. Only the reader moves read_, and only the
+  // writer moves written_.
+  std::atomic<size_t> read_;
+  std::atomic<size_t> written_;
+};
+
+const size_t DEFAULT_MEMORY_SERIAL_CAPACITY = 64 * 1024;
+
+// One end of a serial line held in memory, for simulations and tests: fast,
+// and nothing shared with other processes. Each end reads from its own ring,
+// which the other end writes into, so the two ends may run on two threads.
+// Like a real UART, bytes written to a full ring are lost.
+class MemorySerial : public SerialInterface {
+ public:
+  explicit MemorySerial(size_t capacity = DEFAULT_MEMORY_SERIAL_CAPACITY);
+  // Joins two ends. Until then, writes go nowhere.
+  static void Connect(MemorySerial *a, MemorySerial *b);
+
+  void write(const unsigned char c) override;
+  // 0xff if nothing has arrived.
+  unsigned char read() override;
+  bool available() override;
+  size_t write(const unsigned char *buf, size_t length) override;
+  size_t read(unsigned char *buf, size_t length) override;
+  size_t available_bytes() override;
+  size_t available_for_write() override;
+
+ private:
+  SpscByteRing incoming_;
+  MemorySerial *peer_;
+};
+
+}  // namespace tensixty
+
+#endif  // TENSIXTY_TESTS_MEMORY_SERIAL_H_
@@ -0,0 +1,85 @@
+// Using https://github.com/google/googletest
+#include <gtest/gtest.h>
+#include <string.h>
+#include <thread>
+#include "memory_serial.h"
+
+namespace tensixty {
+
+namespace {
+
+TEST(MemorySerialTest, CarriesBytesBothWays) {
+  MemorySerial a, b;
+  const unsigned char hello[5] = {'h', 'e', 'l', 'l', 'o'};
+  // Nowhere to go yet.
+  EXPECT_EQ(0, a.write(hello, sizeof(hello)));
+  MemorySerial::Connect(&a, &b);
+  EXPECT_FALSE(b.available());
+  EXPECT_EQ(sizeof(hello), a.write(hello, sizeof(hello)));
+  b.write(7);
+  EXPECT_EQ(sizeof(hello), b.available_bytes());
+  unsigned char in[8];
+  EXPECT_EQ(sizeof(hello), b.read(in, sizeof(in)));
+  EXPECT_EQ(0, memcmp(hello, in, sizeof(hello)));
+  ASSERT_TRUE(a.available());
+  EXPECT_EQ(7, a.read());
+  EXPECT_EQ(0xff, a.read());
+}
+
+TEST(MemorySerialTest, FullRingDropsTheRest) {
+  MemorySerial a(10), b(10);
+  MemorySerial::Connect(&a, &b);
+  unsigned char out[17];
+  for (int i = 0; i < 17; ++i) out[i] = i;
+  EXPECT_EQ(10, a.available_for_write());
+  EXPECT_EQ(6, a.write(out, 6));
+  EXPECT_EQ(4, a.available_for_write());
+  EXPECT_EQ(4, a.write(out + 6, 10));
+  EXPECT_EQ(0, a.write(out, 1));
+  // Reading some makes room, and the next writes wrap around the end.
+  unsigned char in[17];
+  EXPECT_EQ(7, b.read(in, 7));
+  EXPECT_EQ(7, a.write(out + 10, 7));
+  EXPECT_EQ(10, b.read(in + 7, sizeof(in) - 7));
+  EXPECT_EQ(0, b.available_bytes());
+  // Every byte that fit, in order.
+  for (int i = 0; i < 17; ++i) EXPECT_EQ(i, in[i]);
+}
+
+TEST(MemorySerialTest, ThreadsShareALine) {
+  MemorySerial a(256), b(256);
+  MemorySerial::Connect(&a, &b);
+  const size_t total = 1 << 18;
+  std::thread writer([&a, total]() {
+    unsigned char chunk[100];
+    size_t sent = 0;
+    while (sent < total) {
+      size_t length = total - sent < sizeof(chunk) ? total - sent : sizeof(chunk);
+      for (size_t i = 0; i < length; ++i) chunk[i] = (sent + i) * 13 & 0xff;
+      // Only write what fits, so nothing is lost.
+      const size_t room = a.available_for_write();
+      if (length > room) length = room;
+      sent += a.write(chunk, length);
+      // Lets the reader in, on a machine with one core.
+      if (length == 0) std::this_thread::yield();
+    }
+  });
+  size_t received = 0;
+  bool in_order = true;
+  unsigned char chunk[77];
+  while (received < total) {
+    const size_t length = b.read(chunk, sizeof(chunk));
+    for (size_t i = 0; i < length; ++i) {
+      in_order = in_order && chunk[i] == ((received + i) * 13 & 0xff);
+    }
+    received += length;
+    if (length == 0) std::this_thread::yield();
+  }
+  writer.join();
+  EXPECT_TRUE(in_order);
+  EXPECT_FALSE(b.available());
+}
+
+}  // namespace
+
+}  // namespace tensixty
@@ -0,0 +1,72 @@
+// Times parsing of a noisy byte stream, where every other frame has a
+// corrupted payload byte and has to be recovered from.
+
+#include "cc/packet.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace tensixty {
+namespace {
+
+const int NUM_FRAMES = 2000;
+const unsigned int FRAME_SIZE = 7 + 255 + 2;
+
+unsigned int BuildStream(unsigned char *stream) {
+  unsigned char message[255];
+  unsigned int length = 0;
+  for (int frame = 0; frame < NUM_FRAMES; ++frame) {
+    for (int i = 0; i < 255; ++i) {
+      message[i] = rand();
+    }
+    Packet packet;
+    packet.IncludeData(frame % 127 + 1, message, 255);
+    unsigned int data_bytes;
+    packet.Serialize(stream + length, stream + length + 7, &data_bytes);
+    if (frame % 2 == 1) {
+      stream[length + 7 + rand() % 255] ^= 0x40;
+    }
+    length += 7 + data_bytes;
+  }
+  return length;
+}
+
+}  // namespace
+}  // namespace tensixty
+
+int main() {
+  using std::chrono::steady_clock;
+  static unsigned char stream[tensixty::NUM_FRAMES * tensixty::FRAME_SIZE];
+  const unsigned int length = tensixty::BuildStream(stream);
+
+  {
+    tensixty::Packet packet;
+    int num_parsed = 0;
+    const steady_clock::time_point start = steady_clock::now();
+    for (unsigned int i = 0; i < length; ++i) {
+      const tensixty::ParseStatus status = packet.ParseChar(stream[i]);
+      if (status == tensixty::PARSED) ++num_parsed;
+      if (status != tensixty::INCOMPLETE) packet.Reset();
+    }
+    const double seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+    fprintf(stderr, "ParseChar: %d of %d frames from %u bytes in %.3f ms (%.1f MB/s)\n",
+        num_parsed, tensixty::NUM_FRAMES, length, 1e3 * seconds, length / seconds / 1e6);
+  }
+  {
+    tensixty::Packet packet;
+    int num_parsed = 0;
+    const steady_clock::time_point start = steady_clock::now();
+    for (unsigned int i = 0; i < length;) {
+      size_t consumed;
+      const size_t chunk = length - i < 64 ? length - i : 64;
+      const tensixty::ParseStatus status = packet.Parse(stream + i, chunk, &consumed);
+      i += consumed;
+      if (status == tensixty::PARSED) ++num_parsed;
+      if (status != tensixty::INCOMPLETE) packet.Reset();
+    }
+    const double seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+    fprintf(stderr, "Parse:     %d of %d frames from %u bytes in %.3f ms (%.1f MB/s)\n",
+        num_parsed, tensixty::NUM_FRAMES, length, 1e3 * seconds, length / seconds / 1e6);
+  }
+  return 0;
+}
@@ -1,6 +1,7 @@
 // Using https://github.com/google/googletest
 
 #include <gtest/gtest.h>
+#include <string.h>
 #include "cc/packet.h"
 
 namespace tensixty {
@@ -91,6 +92,58 @@ TEST(PacketTest, ParseOkay) {
   }
 }
 
+TEST(PacketTest, FrameIsWireReady) {
+  const unsigned char message[3] = {7, 10, 60};
+  Packet original;
+  original.IncludeData(5, message, 3);
+  // Acks are attached after the data, just before sending.
+  original.IncludeAck(Ack(0x83));
+  unsigned int frame_length;
+  const unsigned char *frame = original.frame(&frame_length);
+  ASSERT_EQ(frame_length, 7u + 3 + 2);
+  unsigned char header[7], data[5];
+  unsigned int data_bytes;
+  original.Serialize(header, data, &data_bytes);
+  EXPECT_EQ(0, memcmp(frame, header, 7));
+  EXPECT_EQ(0, memcmp(frame + 7, data, data_bytes));
+
+  Packet parsed;
+  size_t consumed;
+  ASSERT_EQ(PARSED, parsed.Parse(frame, frame_length, &consumed));
+  EXPECT_EQ(consumed, frame_length);
+  EXPECT_EQ(parsed.ack().Serialize(), 0x83);
+  unsigned int parsed_length;
+  const unsigned char *parsed_frame = parsed.frame(&parsed_length);
+  ASSERT_EQ(parsed_length, frame_length);
+  EXPECT_EQ(0, memcmp(frame, parsed_frame, frame_length));
+}
+
+TEST(PacketTest, DataInTwoPieces) {
+  const unsigned char header[2] = {7, 10};
+  const unsigned char data[3] = {60, 61, 62};
+  const unsigned char joined[5] = {7, 10, 60, 61, 62};
+  Packet pieces, whole;
+  pieces.IncludeData(5, header, 2, data, 3);
+  whole.IncludeData(5, joined, 5);
+  unsigned int pieces_length, whole_length;
+  const unsigned char *pieces_frame = pieces.frame(&pieces_length);
+  const unsigned char *whole_frame = whole.frame(&whole_length);
+  ASSERT_EQ(whole_length, pieces_length);
+  EXPECT_EQ(0, memcmp(whole_frame, pieces_frame, whole_length));
+}
+
+TEST(PacketTest, EmptyPacketFrame) {
+  Packet ack_only;
+  ack_only.IncludeAck(Ack(0x05));
+  unsigned int frame_length;
+  const unsigned char *frame = ack_only.frame(&frame_length);
+  Packet parsed;
+  size_t consumed;
+  ASSERT_EQ(PARSED, parsed.Parse(frame, frame_length, &consumed));
+  EXPECT_EQ(parsed.ack().index(), 5);
+  EXPECT_EQ(parsed.index_sending(), 0);
+}
+
 TEST(PacketTest, ParseHeaderNotOkay) {
   for (int i = 0; i < 7; ++i) {
     unsigned char header[7], data[15];
@@ -105,7 +158,8 @@ TEST(PacketTest, ParseHeaderNotOkay) {
       original.data(&length);
       original.Serialize(header, data, &data_bytes);
     }
-    header[i] += 1;
+    // 61 would start an extended header, so skip past the other formats.
+    header[i] += i == 1 ? 4 : 1;
     {
       Packet parsed;
       if (i == 0) {
@@ -172,5 +226,559 @@ TEST(PacketTest, ParseDataNotOkay) {
   }
 }
 
+// Appends a serialized packet to stream, returning the new stream length.
+unsigned int AppendPacket(const unsigned char index, const unsigned char length,
+    unsigned char *stream, unsigned int stream_length) {
+  unsigned char message[255];
+  for (int i = 0; i < length; ++i) {
+    message[i] = index * 3 + i;
+  }
+  Packet packet;
+  packet.IncludeAck(Ack(index));
+  packet.IncludeData(index, message, length);
+  unsigned int data_bytes;
+  packet.Serialize(stream + stream_length, stream + stream_length + 7, &data_bytes);
+  return stream_length + 7 + data_bytes;
+}
+
+TEST(PacketTest, BulkParseMatchesParseChar) {
+  unsigned char stream[1024];
+  unsigned int stream_length = 0;
+  stream[stream_length++] = 23;
+  stream_length = AppendPacket(1, 4, stream, stream_length);
+  for (int i = 0; i < 40; ++i) {
+    stream[stream_length++] = i % 3 == 0 ? 10 : i;
+  }
+  stream_length = AppendPacket(2, 255, stream, stream_length);
+  stream[stream_length++] = 10;
+  stream[stream_length++] = 9;
+  stream_length = AppendPacket(3, 0, stream, stream_length);
+  // Corrupt the payload of a fourth packet.
+  const unsigned int corrupt_start = stream_length;
+  stream_length = AppendPacket(4, 30, stream, stream_length);
+  stream[corrupt_start + 12] += 1;
+  stream_length = AppendPacket(5, 17, stream, stream_length);
+
+  ParseStatus expected[1024];
+  unsigned char expected_index[1024];
+  int expected_num_parsed = 0;
+  Packet reference;
+  for (unsigned int i = 0; i < stream_length; ++i) {
+    expected[i] = reference.ParseChar(stream[i]);
+    if (expected[i] == PARSED) ++expected_num_parsed;
+    expected_index[i] = reference.index_sending();
+    if (expected[i] != INCOMPLETE) reference.Reset();
+  }
+
+  for (unsigned int chunk = 1; chunk < 300; chunk += 13) {
+    Packet parsed;
+    int num_parsed = 0;
+    unsigned int offset = 0;
+    while (offset < stream_length) {
+      size_t length = stream_length - offset;
+      if (length > chunk) length = chunk;
+      size_t consumed;
+      const ParseStatus status = parsed.Parse(stream + offset, length, &consumed);
+      ASSERT_GT(consumed, 0u);
+      ASSERT_LE(consumed, length);
+      offset += consumed;
+      if (status == HEADER_ERROR) {
+        // Junk is skipped as a single header error. Bytes that could not
+        // start a frame may have looked like the start of one, one at a time.
+        for (unsigned int i = offset - consumed; i < offset; ++i) {
+          EXPECT_NE(PARSED, expected[i]) << "chunk " << chunk << " byte " << i;
+        }
+      } else {
+        for (unsigned int i = offset - consumed; i + 1 < offset; ++i) {
+          EXPECT_EQ(INCOMPLETE, expected[i]) << "chunk " << chunk << " byte " << i;
+        }
+        ASSERT_EQ(expected[offset - 1], status) << "chunk " << chunk << " byte " << offset - 1;
+      }
+      if (status == PARSED) {
+        ++num_parsed;
+        EXPECT_EQ(expected_index[offset - 1], parsed.index_sending());
+        unsigned char length;
+        const unsigned char *contents = parsed.data(&length);
+        for (int i = 0; i < length; ++i) {
+          EXPECT_EQ(static_cast<unsigned char>(parsed.index_sending() * 3 + i), contents[i]);
+        }
+      }
+      if (status != INCOMPLETE) parsed.Reset();
+    }
+    EXPECT_EQ(expected_num_parsed, num_parsed) << "chunk " << chunk;
+  }
+}
+
+// Parses the stream one byte at a time, returning the index of every packet
+// parsed, in order.
+int ParseAll(const unsigned char *stream, const unsigned int stream_length,
+    unsigned char *indices) {
+  int num_parsed = 0;
+  Packet parsed;
+  for (unsigned int i = 0; i < stream_length; ++i) {
+    const ParseStatus status = parsed.ParseChar(stream[i]);
+    if (status == PARSED) {
+      indices[num_parsed++] = parsed.index_sending();
+    }
+    if (status != INCOMPLETE) parsed.Reset();
+  }
+  return num_parsed;
+}
+
+TEST(PacketTest, ResyncOnFrameInsideCorruptHeader) {
+  unsigned char stream[64];
+  // A truncated frame start followed immediately by a full frame.
+  stream[0] = 10;
+  stream[1] = 60;
+  stream[2] = 5;
+  unsigned int stream_length = AppendPacket(9, 4, stream, 3);
+  unsigned char indices[4];
+  ASSERT_EQ(1, ParseAll(stream, stream_length, indices));
+  EXPECT_EQ(9, indices[0]);
+
+  // Repeated start bytes.
+  stream[0] = 10;
+  stream[1] = 10;
+  stream[2] = 10;
+  stream_length = AppendPacket(11, 0, stream, 3);
+  ASSERT_EQ(1, ParseAll(stream, stream_length, indices));
+  EXPECT_EQ(11, indices[0]);
+}
+
+TEST(PacketTest, ResyncAfterHeaderChecksumSkipsStaleBytes) {
+  // A first frame leaves a start byte where the next payload would go.
+  const unsigned char stale[3] = {10, 1, 2};
+  const unsigned char message[3] = {60, 61, 62};
+  Packet sender;
+  sender.IncludeData(5, stale, 3);
+  unsigned int length;
+  const unsigned char *frame = sender.frame(&length);
+  Packet parsed;
+  size_t consumed;
+  ASSERT_EQ(PARSED, parsed.Parse(frame, length, &consumed));
+  parsed.Reset();
+
+  // The next frame fails on its last header byte, fed in chunks.
+  unsigned char stream[2 * MAX_FRAME_SIZE];
+  sender.IncludeData(6, message, 3);
+  frame = sender.frame(&length);
+  memcpy(stream, frame, length);
+  stream[HEADER_SIZE - 1] ^= 0xff;
+  sender.IncludeData(7, message, 3);
+  const unsigned char *next = sender.frame(&length);
+  memcpy(stream + HEADER_SIZE + 5, next, length);
+  const unsigned int stream_length = HEADER_SIZE + 5 + length;
+  EXPECT_EQ(INCOMPLETE, parsed.Parse(stream, HEADER_SIZE - 1, &consumed));
+  EXPECT_EQ(HEADER_ERROR, parsed.Parse(stream + HEADER_SIZE - 1, 1, &consumed));
+
+  // Its payload is junk, and the frame after it parses.
+  unsigned int offset = HEADER_SIZE;
+  ParseStatus status = INCOMPLETE;
+  while (offset < stream_length) {
+    status = parsed.Parse(stream + offset, stream_length - offset, &consumed);
+    offset += consumed;
+    if (status == PARSED) break;
+  }
+  ASSERT_EQ(PARSED, status);
+  EXPECT_EQ(stream_length, offset);
+  EXPECT_EQ(7, parsed.index_sending());
+  unsigned char data_length;
+  EXPECT_EQ(0, memcmp(message, parsed.data(&data_length), 3));
+}
+
+TEST(PacketTest, ResyncOnFrameInsideCorruptPayload) {
+  // The first frame is cut short by another, so its checksum lands inside the
+  // second frame's payload. Both following frames must still be found.
+  unsigned char stream[512];
+  unsigned int stream_length = AppendPacket(1, 30, stream, 0);
+  stream_length = 20;
+  stream_length = AppendPacket(2, 30, stream, stream_length);
+  stream_length = AppendPacket(3, 40, stream, stream_length);
+  unsigned char indices[4];
+  ASSERT_EQ(2, ParseAll(stream, stream_length, indices));
+  EXPECT_EQ(2, indices[0]);
+  EXPECT_EQ(3, indices[1]);
+}
+
+TEST(PacketTest, NoResyncOnCorruptEmbeddedFrame) {
+  unsigned char stream[512];
+  unsigned int stream_length = AppendPacket(1, 100, stream, 0);
+  const unsigned int embedded_start = 30;
+  AppendPacket(2, 10, stream, embedded_start);
+  // Corrupt the embedded frame's payload, so only the outer frame's data
+  // error remains.
+  stream[embedded_start + 7 + 3] += 1;
+  unsigned char indices[4];
+  EXPECT_EQ(0, ParseAll(stream, stream_length, indices));
+}
+
+TEST(AckTest, ExtendedIndices) {
+  Ack a;
+  a.Parse(true, 0x1234);
+  EXPECT_EQ(a.index(), 0x1234);
+  EXPECT_TRUE(a.error());
+  EXPECT_EQ(a.SerializeExtended(), 0x9234);
+  Ack b;
+  b.ParseExtended(0x0456);
+  EXPECT_EQ(b.index(), 0x456);
+  EXPECT_TRUE(b.ok());
+  // The basic and extended forms of the start sequence ack agree.
+  Ack start(0x80);
+  EXPECT_TRUE(start.is_start_sequence_ack());
+  EXPECT_EQ(start.SerializeExtended(), 0x8000);
+  EXPECT_EQ(start.Serialize(), 0x80);
+}
+
+TEST(PacketTest, ExtendedHeaderRoundTrip) {
+  const unsigned char message[3] = {7, 60, 10};
+  Packet original;
+  original.IncludeData(1000, message, 3);
+  original.IncludeAck(Ack(0x80));
+  // Switching after the data is included keeps the payload.
+  original.UseExtendedHeader(true);
+  Ack ack;
+  ack.Parse(true, 20000);
+  original.IncludeAck(ack);
+  unsigned int frame_length;
+  const unsigned char *frame = original.frame(&frame_length);
+  ASSERT_EQ(EXTENDED_HEADER_SIZE + 3 + 2, frame_length);
+  EXPECT_EQ(61, frame[1]);
+
+  Packet parsed;
+  size_t consumed;
+  ASSERT_EQ(PARSED, parsed.Parse(frame, frame_length, &consumed));
+  EXPECT_EQ(frame_length, consumed);
+  EXPECT_TRUE(parsed.extended());
+  EXPECT_FALSE(parsed.start_sequence());
+  EXPECT_EQ(1000, parsed.index_sending());
+  EXPECT_EQ(20000, parsed.ack().index());
+  EXPECT_TRUE(parsed.ack().error());
+  unsigned char length;
+  const unsigned char *data = parsed.data(&length);
+  ASSERT_EQ(3, length);
+  EXPECT_EQ(0, memcmp(message, data, 3));
+
+  // And back again.
+  original.UseExtendedHeader(false);
+  frame = original.frame(&frame_length);
+  ASSERT_EQ(HEADER_SIZE + 3 + 2, frame_length);
+  parsed.Reset();
+  ASSERT_EQ(PARSED, parsed.Parse(frame, frame_length, &consumed));
+  EXPECT_FALSE(parsed.extended());
+  EXPECT_EQ(0, memcmp(message, parsed.data(&length), 3));
+}
+
+TEST(PacketTest, ExtendedIndex0x80IsNotStartSequence) {
+  Packet p;
+  p.UseExtendedHeader(true);
+  p.IncludeData(0x80, nullptr, 0);
+  unsigned int frame_length;
+  const unsigned char *frame = p.frame(&frame_length);
+  Packet parsed;
+  size_t consumed;
+  ASSERT_EQ(PARSED, parsed.Parse(frame, frame_length, &consumed));
+  EXPECT_EQ(0x80, parsed.index_sending());
+  EXPECT_FALSE(parsed.start_sequence());
+}
+
+TEST(PacketTest, ResyncFindsExtendedFrame) {
+  unsigned char stream[64];
+  // A truncated basic frame start, then an extended frame.
+  stream[0] = 10;
+  stream[1] = 60;
+  stream[2] = 5;
+  Packet p;
+  p.UseExtendedHeader(true);
+  const unsigned char message[4] = {1, 2, 3, 4};
+  p.IncludeData(300, message, 4);
+  unsigned int frame_length;
+  const unsigned char *frame = p.frame(&frame_length);
+  memcpy(stream + 3, frame, frame_length);
+  Packet parsed;
+  int num_parsed = 0;
+  for (unsigned int i = 0; i < 3 + frame_length; ++i) {
+    const ParseStatus status = parsed.ParseChar(stream[i]);
+    if (status == PARSED) {
+      ++num_parsed;
+      EXPECT_EQ(300, parsed.index_sending());
+    }
+    if (status != INCOMPLETE) parsed.Reset();
+  }
+  EXPECT_EQ(1, num_parsed);
+}
+
+TEST(AckTest, SelectiveBitmap) {
+  Ack a;
+  a.Parse(false, 100);
+  EXPECT_FALSE(a.has_selective());
+  EXPECT_EQ(0, a.selective_size());
+  a.SetSelective(0);
+  EXPECT_EQ(2, a.selective_size());
+  a.SetSelective(20);
+  EXPECT_EQ(4, a.selective_size());
+  a.SetSelective(63);
+  EXPECT_EQ(8, a.selective_size());
+  // Beyond the bitmap; dropped.
+  a.SetSelective(64);
+  EXPECT_TRUE(a.selective(0));
+  EXPECT_FALSE(a.selective(1));
+  EXPECT_TRUE(a.selective(20));
+  EXPECT_TRUE(a.selective(63));
+  EXPECT_FALSE(a.selective(64));
+  Ack b;
+  b = a;
+  EXPECT_TRUE(b.selective(20));
+  // Parsing a new ack clears the bitmap.
+  b.Parse(false, 5);
+  EXPECT_FALSE(b.has_selective());
+}
+
+TEST(PacketTest, SelectiveAckRoundTrip) {
+  const unsigned char message[2] = {8, 9};
+  Packet original;
+  original.UseExtendedHeader(true);
+  original.IncludeData(500, message, 2);
+  Ack ack;
+  ack.Parse(false, 1234);
+  ack.SetSelective(1);
+  ack.SetSelective(30);
+  original.IncludeAck(ack);
+  unsigned int frame_length;
+  const unsigned char *frame = original.frame(&frame_length);
+  ASSERT_EQ(EXTENDED_HEADER_SIZE + 4 + 2 + 2, frame_length);
+
+  Packet parsed;
+  size_t consumed;
+  ASSERT_EQ(PARSED, parsed.Parse(frame, frame_length, &consumed));
+  EXPECT_EQ(500, parsed.index_sending());
+  EXPECT_EQ(1234, parsed.ack().index());
+  EXPECT_TRUE(parsed.ack().selective(1));
+  EXPECT_TRUE(parsed.ack().selective(30));
+  EXPECT_FALSE(parsed.ack().selective(2));
+  unsigned char length;
+  EXPECT_EQ(0, memcmp(message, parsed.data(&length), 2));
+
+  // A plain ack shrinks the header again.
+  original.IncludeAck(Ack(0x05));
+  original.frame(&frame_length);
+  EXPECT_EQ(EXTENDED_HEADER_SIZE + 2 + 2, frame_length);
+  EXPECT_EQ(0, memcmp(message, original.data(&length), 2));
+}
+
+TEST(PacketTest, CompactAckRoundTrip) {
+  Packet original;
+  original.IncludeAck(Ack(0x85));
+  original.UseCompactAck(true);
+  unsigned int frame_length;
+  const unsigned char *frame = original.frame(&frame_length);
+  ASSERT_EQ(ACK_FRAME_SIZE, frame_length);
+  EXPECT_EQ(62, frame[1]);
+
+  Packet parsed;
+  size_t consumed;
+  ASSERT_EQ(PARSED, parsed.Parse(frame, frame_length, &consumed));
+  EXPECT_EQ(frame_length, consumed);
+  EXPECT_TRUE(parsed.compact());
+  EXPECT_FALSE(parsed.extended());
+  EXPECT_EQ(0, parsed.index_sending());
+  EXPECT_EQ(5, parsed.ack().index());
+  EXPECT_TRUE(parsed.ack().error());
+  unsigned char length;
+  parsed.data(&length);
+  EXPECT_EQ(0, length);
+
+  // Extended, with a selective ack bitmap.
+  Ack ack;
+  ack.Parse(false, 1234);
+  ack.SetSelective(3);
+  original.UseExtendedHeader(true);
+  original.IncludeAck(ack);
+  frame = original.frame(&frame_length);
+  ASSERT_EQ(EXTENDED_ACK_FRAME_SIZE + 2, frame_length);
+  EXPECT_EQ(63, frame[1]);
+  parsed.Reset();
+  ASSERT_EQ(PARSED, parsed.Parse(frame, frame_length, &consumed));
+  EXPECT_TRUE(parsed.compact());
+  EXPECT_TRUE(parsed.extended());
+  EXPECT_EQ(1234, parsed.ack().index());
+  EXPECT_TRUE(parsed.ack().selective(3));
+  EXPECT_FALSE(parsed.ack().selective(2));
+
+  // Serialize sends no data block.
+  unsigned char header[MAX_HEADER_SIZE];
+  unsigned char data[MAX_FRAME_SIZE];
+  unsigned int data_bytes = 1;
+  original.Serialize(header, data, &data_bytes);
+  EXPECT_EQ(0, data_bytes);
+  EXPECT_EQ(0, memcmp(frame, header, frame_length));
+}
+
+TEST(PacketTest, CompactAckChecksum) {
+  Packet original;
+  original.IncludeAck(Ack(0x05));
+  original.UseCompactAck(true);
+  unsigned int frame_length;
+  unsigned char frame[ACK_FRAME_SIZE];
+  memcpy(frame, original.frame(&frame_length), ACK_FRAME_SIZE);
+  frame[2] ^= 0x02;
+  Packet parsed;
+  ParseStatus status = INCOMPLETE;
+  for (unsigned int i = 0; i < frame_length; ++i) {
+    status = parsed.ParseChar(frame[i]);
+    if (status != INCOMPLETE) break;
+  }
+  EXPECT_EQ(HEADER_ERROR, status);
+}
+
+TEST(PacketTest, CompactAckBetweenFrames) {
+  // Junk, a compact ack, then a data frame.
+  unsigned char stream[64] = {10, 62};
+  Packet ack_only;
+  ack_only.IncludeAck(Ack(0x07));
+  ack_only.UseCompactAck(true);
+  unsigned int ack_length;
+  const unsigned char *ack_frame = ack_only.frame(&ack_length);
+  memcpy(stream + 2, ack_frame, ack_length);
+  Packet p;
+  const unsigned char message[3] = {4, 5, 6};
+  p.IncludeData(9, message, 3);
+  unsigned int frame_length;
+  const unsigned char *frame = p.frame(&frame_length);
+  memcpy(stream + 2 + ack_length, frame, frame_length);
+  const size_t stream_length = 2 + ack_length + frame_length;
+
+  Packet parsed;
+  int num_parsed = 0;
+  size_t offset = 0;
+  while (offset < stream_length) {
+    size_t consumed;
+    const ParseStatus status = parsed.Parse(stream + offset, stream_length - offset, &consumed);
+    offset += consumed;
+    if (status == PARSED) {
+      if (num_parsed++ == 0) {
+        EXPECT_TRUE(parsed.compact());
+        EXPECT_EQ(7, parsed.ack().index());
+      } else {
+        EXPECT_FALSE(parsed.compact());
+        EXPECT_EQ(9, parsed.index_sending());
+      }
+    }
+    if (status != INCOMPLETE) parsed.Reset();
+  }
+  EXPECT_EQ(2, num_parsed);
+}
+
+TEST(PacketTest, CreditRoundTrip) {
+  const unsigned char message[2] = {8, 9};
+  Packet original;
+  original.UseExtendedHeader(true);
+  original.IncludeData(500, message, 2);
+  Ack ack;
+  ack.Parse(false, 1234);
+  ack.SetSelective(2);
+  ack.SetCredit(7);
+  original.IncludeAck(ack);
+  unsigned int frame_length;
+  const unsigned char *frame = original.frame(&frame_length);
+  ASSERT_EQ(EXTENDED_HEADER_SIZE + 2 + CREDIT_SIZE + 2 + 2, frame_length);
+
+  Packet parsed;
+  size_t consumed;
+  ASSERT_EQ(PARSED, parsed.Parse(frame, frame_length, &consumed));
+  EXPECT_EQ(500, parsed.index_sending());
+  EXPECT_EQ(1234, parsed.ack().index());
+  EXPECT_TRUE(parsed.ack().selective(2));
+  ASSERT_TRUE(parsed.ack().has_credit());
+  EXPECT_EQ(7, parsed.ack().credit());
+  unsigned char length;
+  EXPECT_EQ(0, memcmp(message, parsed.data(&length), 2));
+
+  // And alone in a compact frame, where a credit of 0 still counts.
+  Ack empty;
+  empty.Parse(false, 1300);
+  empty.SetCredit(0);
+  Packet ack_only;
+  ack_only.UseExtendedHeader(true);
+  ack_only.UseCompactAck(true);
+  ack_only.IncludeAck(empty);
+  frame = ack_only.frame(&frame_length);
+  ASSERT_EQ(EXTENDED_ACK_FRAME_SIZE + CREDIT_SIZE, frame_length);
+  parsed.Reset();
+  ASSERT_EQ(PARSED, parsed.Parse(frame, frame_length, &consumed));
+  EXPECT_EQ(1300, parsed.ack().index());
+  EXPECT_TRUE(parsed.ack().has_credit());
+  EXPECT_EQ(0, parsed.ack().credit());
+
+  // Acks parsed afresh have none.
+  empty.Parse(false, 3);
+  EXPECT_FALSE(empty.has_credit());
+}
+
+TEST(PacketTest, ChannelRoundTrip) {
+  const unsigned char settings[3] = {1, 0, 16};
+  Packet original;
+  original.UseExtendedHeader(true);
+  original.UseChannel(3);
+  original.IncludeData(0, settings, 3);
+  original.MarkStartSequence();
+  Ack ack;
+  ack.Parse(false, 9);
+  ack.SetCredit(5);
+  original.IncludeAck(ack);
+  unsigned int frame_length;
+  const unsigned char *frame = original.frame(&frame_length);
+  ASSERT_EQ(EXTENDED_HEADER_SIZE + CREDIT_SIZE + CHANNEL_SIZE + 3 + 2, frame_length);
+
+  Packet parsed;
+  size_t consumed;
+  ASSERT_EQ(PARSED, parsed.Parse(frame, frame_length, &consumed));
+  EXPECT_EQ(3, parsed.channel());
+  EXPECT_TRUE(parsed.start_sequence());
+  EXPECT_EQ(0, parsed.index_sending());
+  EXPECT_EQ(5, parsed.ack().credit());
+  unsigned char length;
+  EXPECT_EQ(0, memcmp(settings, parsed.data(&length), 3));
+
+  // Parsing a channel 0 frame into the same packet clears both.
+  Packet plain;
+  plain.UseExtendedHeader(true);
+  plain.IncludeData(7, settings, 3);
+  frame = plain.frame(&frame_length);
+  parsed.Reset();
+  ASSERT_EQ(PARSED, parsed.Parse(frame, frame_length, &consumed));
+  EXPECT_EQ(0, parsed.channel());
+  EXPECT_FALSE(parsed.start_sequence());
+}
+
+TEST(PacketTest, Datagram) {
+  const unsigned char report[2] = {0x96, 1};
+  Packet datagram;
+  datagram.IncludeData(0, report, 2);
+  EXPECT_TRUE(datagram.datagram());
+  unsigned int frame_length;
+  const unsigned char *frame = datagram.frame(&frame_length);
+  Packet parsed;
+  size_t consumed;
+  ASSERT_EQ(PARSED, parsed.Parse(frame, frame_length, &consumed));
+  EXPECT_TRUE(parsed.datagram());
+  EXPECT_FALSE(parsed.start_sequence());
+
+  // Neither ack-only frames, start sequences nor sequenced data are.
+  Packet ack_only;
+  EXPECT_FALSE(ack_only.datagram());
+  Packet start;
+  start.IncludeData(0x80, report, 2);
+  EXPECT_FALSE(start.datagram());
+  Packet channel_start;
+  channel_start.UseExtendedHeader(true);
+  channel_start.UseChannel(1);
+  channel_start.IncludeData(0, report, 2);
+  channel_start.MarkStartSequence();
+  EXPECT_FALSE(channel_start.datagram());
+  Packet sequenced;
+  sequenced.IncludeData(5, report, 2);
+  EXPECT_FALSE(sequenced.datagram());
+}
+
 }  // namespace
 }  // namespace tensixty
@@ -0,0 +1,106 @@
+// Using https://github.com/google/googletest
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <string.h>
+#include "cc/commlink.h"
+#include "cc/posix_serial.h"
+#include "arduino_simulator.h"
+
+namespace tensixty {
+
+namespace {
+
+// Waits briefly for bytes to arrive on any of the ends.
+void WaitForInput(PosixSerial *a, PosixSerial *b) {
+  struct pollfd fds[2] = {{a->fd(), POLLIN, 0}, {b->fd(), POLLIN, 0}};
+  poll(fds, 2, 1);
+}
+
+// Reads length bytes from serial, waiting for them if need be.
+size_t ReadAll(PosixSerial *serial, unsigned char *buf, const size_t length) {
+  size_t total = 0;
+  for (int tries = 0; tries < 1000 && total < length; ++tries) {
+    total += serial->read(buf + total, length - total);
+    if (total < length) {
+      struct pollfd in = {serial->fd(), POLLIN, 0};
+      poll(&in, 1, 10);
+    }
+  }
+  return total;
+}
+
+TEST(PosixSerialTest, RejectsMissingDevicesAndOddRates) {
+  PosixSerial serial;
+  EXPECT_FALSE(serial.Open("/dev/tensixty_no_such_device"));
+  EXPECT_FALSE(serial.is_open());
+  EXPECT_EQ(-1, serial.fd());
+  PosixSerial master, slave;
+  PosixSerialConfig config;
+  config.baud = 12345;
+  EXPECT_FALSE(PosixSerial::OpenPtyPair(&master, &slave, config));
+  EXPECT_FALSE(master.is_open());
+}
+
+TEST(PosixSerialTest, PtyPairCarriesBytesBothWays) {
+  PosixSerial master, slave;
+  ASSERT_TRUE(PosixSerial::OpenPtyPair(&master, &slave));
+  EXPECT_EQ(0, master.read(nullptr, 0));
+  unsigned char out[300];
+  // Raw mode passes every byte value through untouched.
+  for (int i = 0; i < 300; ++i) out[i] = i & 0xff;
+  unsigned char in[300];
+  ASSERT_EQ(sizeof(out), master.write(out, sizeof(out)));
+  ASSERT_EQ(sizeof(in), ReadAll(&slave, in, sizeof(in)));
+  EXPECT_EQ(0, memcmp(out, in, sizeof(out)));
+  EXPECT_FALSE(slave.available());
+  ASSERT_EQ(sizeof(out), slave.write(out, sizeof(out)));
+  ASSERT_EQ(sizeof(in), ReadAll(&master, in, sizeof(in)));
+  EXPECT_EQ(0, memcmp(out, in, sizeof(out)));
+}
+
+TEST(PosixSerialTest, ReportsRoomToWrite) {
+  PosixSerial closed;
+  EXPECT_EQ(0, closed.available_for_write());
+  PosixSerial master, slave;
+  PosixSerialConfig config;
+  config.tx_buffer_size = 1000;
+  ASSERT_TRUE(PosixSerial::OpenPtyPair(&master, &slave, config));
+  // Bounded by the configured buffer, less whatever is still queued.
+  EXPECT_GT(master.available_for_write(), 0);
+  EXPECT_LE(master.available_for_write(), 1000);
+  EXPECT_LE(slave.available_for_write(), 1000);
+}
+
+TEST(PosixSerialTest, LinkRunsOverPty) {
+  PosixSerial master, slave;
+  ASSERT_TRUE(PosixSerial::OpenPtyPair(&master, &slave));
+  FakeClock *clock = GetFakeClock();
+  LinkConfig config;
+  config.window_size = 8;
+  config.cumulative_ack = true;
+  RxTxPair p0(0, *clock, &master, config);
+  RxTxPair p1(1, *clock, &slave, config);
+  EXPECT_EQ(master.fd(), p0.fd());
+  const int num_messages = 100;
+  int sent = 0;
+  int received = 0;
+  for (int ticks = 0; ticks < 5000 && received < num_messages; ++ticks) {
+    const unsigned char message[1] = {static_cast<unsigned char>(sent)};
+    if (sent < num_messages && p0.Initialized() && p0.Transmit(message, 1)) ++sent;
+    p0.Tick();
+    p1.Tick();
+    clock->IncrementTime(1000);
+    unsigned char length;
+    const unsigned char *data;
+    while ((data = p1.Receive(&length)) != nullptr) {
+      EXPECT_EQ(received & 0xff, data[0]);
+      ++received;
+    }
+    WaitForInput(&master, &slave);
+  }
+  EXPECT_EQ(num_messages, received);
+}
+
+}  // namespace
+
+}  // namespace tensixty
@@ -0,0 +1,82 @@
+// Using https://github.com/google/googletest
+
+#include <gtest/gtest.h>
+#include "cc/rtt_estimator.h"
+
+namespace tensixty {
+namespace {
+
+TEST(RttEstimatorTest, InitialTimeout) {
+  RttEstimator rtt(100000, 2000, 2000000);
+  EXPECT_FALSE(rtt.has_sample());
+  EXPECT_EQ(0, rtt.smoothed_rtt());
+  EXPECT_EQ(100000, rtt.rto());
+}
+
+TEST(RttEstimatorTest, FirstSample) {
+  RttEstimator rtt(100000, 2000, 2000000);
+  rtt.AddSample(10000);
+  EXPECT_TRUE(rtt.has_sample());
+  EXPECT_EQ(10000, rtt.smoothed_rtt());
+  EXPECT_EQ(5000, rtt.rtt_variance());
+  // srtt + 4 * rttvar.
+  EXPECT_EQ(30000, rtt.rto());
+}
+
+TEST(RttEstimatorTest, Smoothing) {
+  RttEstimator rtt(100000, 2000, 2000000);
+  rtt.AddSample(10000);
+  rtt.AddSample(18000);
+  // srtt = 10000 + 8000 / 8, rttvar = 3 / 4 * 5000 + 8000 / 4.
+  EXPECT_EQ(11000, rtt.smoothed_rtt());
+  EXPECT_EQ(5750, rtt.rtt_variance());
+  EXPECT_EQ(34000, rtt.rto());
+}
+
+TEST(RttEstimatorTest, SteadyLinkConverges) {
+  RttEstimator rtt(100000, 2000, 2000000);
+  for (int i = 0; i < 100; ++i) {
+    rtt.AddSample(4000);
+  }
+  EXPECT_EQ(4000, rtt.smoothed_rtt());
+  EXPECT_LT(rtt.rtt_variance(), 100);
+  EXPECT_LT(rtt.rto(), 4500);
+}
+
+TEST(RttEstimatorTest, Bounds) {
+  RttEstimator fast(100000, 2000, 2000000);
+  for (int i = 0; i < 100; ++i) {
+    fast.AddSample(100);
+  }
+  EXPECT_EQ(2000, fast.rto());
+  RttEstimator slow(100000, 2000, 2000000);
+  slow.AddSample(5000000);
+  EXPECT_EQ(2000000, slow.rto());
+}
+
+TEST(RttEstimatorTest, BackoffDoublesUntilNextSample) {
+  RttEstimator rtt(100000, 2000, 2000000);
+  rtt.AddSample(10000);
+  rtt.Backoff();
+  EXPECT_EQ(60000, rtt.rto());
+  rtt.Backoff();
+  EXPECT_EQ(120000, rtt.rto());
+  for (int i = 0; i < 10; ++i) {
+    rtt.Backoff();
+  }
+  EXPECT_EQ(2000000, rtt.rto());
+  rtt.AddSample(10000);
+  EXPECT_LT(rtt.rto(), 30000);
+}
+
+TEST(RttEstimatorTest, Reset) {
+  RttEstimator rtt(100000, 2000, 2000000);
+  rtt.AddSample(10000);
+  rtt.Backoff();
+  rtt.Reset();
+  EXPECT_FALSE(rtt.has_sample());
+  EXPECT_EQ(100000, rtt.rto());
+}
+
+}  // namespace
+}  // namespace tensixty
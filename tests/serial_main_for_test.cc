@@ -1,5 +1,6 @@
 #include "arduino_simulator.h"
 #include "cc/commlink.h"
+#include "cc/host_loop.h"
 #include <cstring>
 #include <stdlib.h>
 
@@ -13,8 +14,11 @@ int main(int argc, char **argv) {
   printf("Serial main running.\n");
   tensixty::FakeArduino fake_arduino;
   fake_arduino.UseFiles(argv[1], argv[2]);
-  tensixty::RxTxPair rx_tx_pair(atoi(argv[3]), *tensixty::GetRealClock(), &fake_arduino);
+  tensixty::Clock &clock = *tensixty::GetRealClock();
+  tensixty::RxTxPair rx_tx_pair(atoi(argv[3]), clock, &fake_arduino);
   while (true) {
+    // Sleeps until there is something to do, checking the files every ms.
+    tensixty::WaitForWork(&rx_tx_pair, clock, -1, 1000);
     rx_tx_pair.Tick();
     unsigned char length;
     const unsigned char *incoming = rx_tx_pair.Receive(&length);
@@ -0,0 +1,107 @@
+// Using https://github.com/google/googletest
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include "cc/sync_scanner.h"
+
+namespace tensixty {
+namespace {
+
+const unsigned char* ReferenceFindSyncWord(const unsigned char *buf, const size_t length) {
+  for (size_t i = 0; i < length; ++i) {
+    if (buf[i] == 10 && (i + 1 == length || (buf[i + 1] >= 60 && buf[i + 1] <= 63))) return buf + i;
+  }
+  return buf + length;
+}
+
+TEST(SyncScannerTest, EmptyAndShortBuffers) {
+  const unsigned char buf[3] = {10, 60, 10};
+  EXPECT_EQ(FindSyncWord(buf, 0), buf);
+  EXPECT_EQ(FindSyncWord(buf, 1), buf);
+  EXPECT_EQ(FindSyncWord(buf, 2), buf);
+  EXPECT_EQ(FindSyncWord(buf + 1, 1), buf + 2);
+  EXPECT_EQ(FindSyncWord(buf + 1, 2), buf + 2);
+}
+
+TEST(SyncScannerTest, MatchesReferenceOnRandomBuffers) {
+  unsigned char buf[300];
+  srand(60);
+  for (int trial = 0; trial < 2000; ++trial) {
+    // Mostly start bytes and near misses, so matches land everywhere,
+    // including across vector block boundaries.
+    for (int i = 0; i < 300; ++i) {
+      const int r = rand() % 8;
+      buf[i] = r == 0 ? 10 : r == 1 ? 60 + rand() % 5 : rand();
+    }
+    const size_t start = rand() % 32;
+    const size_t length = rand() % (300 - start);
+    EXPECT_EQ(ReferenceFindSyncWord(buf + start, length), FindSyncWord(buf + start, length))
+      << "trial " << trial;
+  }
+}
+
+TEST(SyncScannerTest, FindFrameStartSkipsBadHeaders) {
+  unsigned char buf[64] = {0};
+  // Start bytes with a bad checksum, then a valid header.
+  buf[3] = 10;
+  buf[4] = 60;
+  unsigned char *header = buf + 20;
+  header[0] = 10;
+  header[1] = 60;
+  header[2] = 0x81;
+  header[3] = 5;
+  header[4] = 12;
+  unsigned char ck_0 = 0, ck_1 = 0;
+  for (int i = 0; i < 5; ++i) {
+    ck_0 += header[i];
+    ck_1 += ck_0;
+  }
+  header[5] = ck_0;
+  header[6] = ck_1;
+  EXPECT_EQ(FindSyncWord(buf, sizeof(buf)), buf + 3);
+  EXPECT_EQ(FindFrameStart(buf, sizeof(buf)), header);
+  // Too short to check the checksum, so it may still be a frame.
+  EXPECT_EQ(FindFrameStart(buf, 8), buf + 3);
+  EXPECT_EQ(FindFrameStart(buf, 3), buf + 3);
+}
+
+TEST(SyncScannerTest, FrameHeaderSize) {
+  const unsigned char basic[3] = {10, 60, 0x81};
+  const unsigned char extended[3] = {10, 61, 0};
+  const unsigned char unknown_flags[3] = {10, 61, 0x40};
+  const unsigned char unknown_format[3] = {10, 64, 0};
+  EXPECT_EQ(7, FrameHeaderSize(basic));
+  EXPECT_EQ(10, FrameHeaderSize(extended));
+  const unsigned char with_sack[3] = {10, 61, 3};
+  EXPECT_EQ(18, FrameHeaderSize(with_sack));
+  const unsigned char ack[3] = {10, 62, 0x85};
+  const unsigned char extended_ack[3] = {10, 63, 1};
+  const unsigned char extended_ack_unknown_flags[3] = {10, 63, 0x20};
+  EXPECT_EQ(5, FrameHeaderSize(ack));
+  EXPECT_EQ(9, FrameHeaderSize(extended_ack));
+  EXPECT_EQ(0, FrameHeaderSize(extended_ack_unknown_flags));
+  const unsigned char with_credit[3] = {10, 61, 0x04};
+  const unsigned char ack_with_credit[3] = {10, 63, 0x05};
+  EXPECT_EQ(11, FrameHeaderSize(with_credit));
+  EXPECT_EQ(10, FrameHeaderSize(ack_with_credit));
+  EXPECT_EQ(0, FrameHeaderSize(unknown_flags));
+  EXPECT_EQ(0, FrameHeaderSize(unknown_format));
+}
+
+TEST(SyncScannerTest, FrameSizeAndChannel) {
+  const unsigned char basic[7] = {10, 60, 0x81, 5, 12, 0, 0};
+  EXPECT_EQ(7 + 12 + 2, FrameSize(basic));
+  EXPECT_EQ(0, FrameChannel(basic));
+  // Credit then channel after the index.
+  const unsigned char extended[12] = {10, 61, 0x1c, 0, 1, 0, 0, 4, 2, 3, 0, 0};
+  EXPECT_EQ(12, FrameHeaderSize(extended));
+  EXPECT_EQ(12 + 3 + 2, FrameSize(extended));
+  EXPECT_EQ(2, FrameChannel(extended));
+  // Compact frames are all header.
+  const unsigned char extended_ack[8] = {10, 63, 0x08, 0, 9, 6, 0, 0};
+  EXPECT_EQ(8, FrameSize(extended_ack));
+  EXPECT_EQ(6, FrameChannel(extended_ack));
+}
+
+}  // namespace
+}  // namespace tensixty
@@ -0,0 +1,57 @@
+// Using https://github.com/google/googletest
+
+#include <gtest/gtest.h>
+#include "cc/trace.h"
+
+namespace tensixty {
+namespace {
+
+TEST(TraceTest, RecordsRoundTrip) {
+  ClearTrace();
+  Trace(TRACE_PACKET_PARSED, 5, 255, -1);
+  Trace(TRACE_WRITER_SEND, 1, 2, 3);
+  TraceRecord records[TENSIXTY_TRACE_BUFFER_SIZE];
+  ASSERT_EQ(2, CopyTrace(records, TENSIXTY_TRACE_BUFFER_SIZE));
+  EXPECT_EQ(TRACE_PACKET_PARSED, records[0].event);
+  EXPECT_EQ(5, records[0].args[0]);
+  EXPECT_EQ(255, records[0].args[1]);
+  EXPECT_EQ(-1, records[0].args[2]);
+  EXPECT_EQ(TRACE_WRITER_SEND, records[1].event);
+  EXPECT_EQ(3, records[1].args[2]);
+}
+
+TEST(TraceTest, WrapKeepsNewestOldestFirst) {
+  ClearTrace();
+  for (int i = 0; i < TENSIXTY_TRACE_BUFFER_SIZE + 3; ++i) {
+    Trace(TRACE_WRITER_QUEUED, 0, i, 0);
+  }
+  TraceRecord records[TENSIXTY_TRACE_BUFFER_SIZE];
+  ASSERT_EQ(TENSIXTY_TRACE_BUFFER_SIZE, CopyTrace(records, TENSIXTY_TRACE_BUFFER_SIZE));
+  for (int i = 0; i < TENSIXTY_TRACE_BUFFER_SIZE; ++i) {
+    EXPECT_EQ(i + 3, records[i].args[1]);
+  }
+  // Asking for fewer returns the most recent ones.
+  ASSERT_EQ(2, CopyTrace(records, 2));
+  EXPECT_EQ(TENSIXTY_TRACE_BUFFER_SIZE + 1, records[0].args[1]);
+  EXPECT_EQ(TENSIXTY_TRACE_BUFFER_SIZE + 2, records[1].args[1]);
+}
+
+TEST(TraceTest, LevelAndCategoryFilter) {
+  ClearTrace();
+  TENSIXTY_TRACE(TRACE_INFO, TRACE_READER, TRACE_READER_BUFFER_FULL, 1, 0, 0);
+  // Above the compiled-in level.
+  TENSIXTY_TRACE(TRACE_DEBUG, TRACE_READER, TRACE_READER_OUTGOING_ACK, 2, 0, 0);
+  // Category masked out.
+  TENSIXTY_TRACE(TRACE_ERROR, TRACE_MOTOR, TRACE_MOTOR_SPEED, 3, 0, 0);
+  TraceRecord records[TENSIXTY_TRACE_BUFFER_SIZE];
+  ASSERT_EQ(1, CopyTrace(records, TENSIXTY_TRACE_BUFFER_SIZE));
+  EXPECT_EQ(TRACE_READER_BUFFER_FULL, records[0].event);
+}
+
+TEST(TraceTest, EventNames) {
+  EXPECT_STREQ("packet parsed", TraceEventName(TRACE_PACKET_PARSED));
+  EXPECT_STREQ("unknown", TraceEventName(0));
+}
+
+}  // namespace
+}  // namespace tensixty